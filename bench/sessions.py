@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Пропускная способность kubsh --server: N одновременных сеансов через сокет
+# против N отдельных запусков kubsh с тем же вводом.
+# Запуск: make bench-sessions или bench/sessions.py ./kubsh [-n 100] [-r 5]
+import argparse
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SCRIPT = b'for i in 1 2 3 4 5; do true; done\n/bin/true\nx=1; printf "%s\\n" done\n'
+
+
+def run_session(sock_path, results, i):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(sock_path)
+    s.sendall(SCRIPT)
+    s.shutdown(socket.SHUT_WR)
+    out = b''
+    while True:
+        data = s.recv(65536)
+        if not data:
+            break
+        out += data
+    s.close()
+    results[i] = out.strip() == b'done'
+
+
+def run_fresh(kubsh, env, results, i):
+    p = subprocess.run([kubsh], input=SCRIPT, capture_output=True, env=env)
+    results[i] = p.stdout.strip() == b'done'
+
+
+def measure(name, clients, rounds, target, *args):
+    best = None
+    for _ in range(rounds):
+        results = [False] * clients
+        threads = [threading.Thread(target=target, args=args + (results, i)) for i in range(clients)]
+        start = time.monotonic()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.monotonic() - start
+        failed = results.count(False)
+        if failed:
+            sys.exit(f'{name}: {failed} of {clients} sessions failed')
+        best = elapsed if best is None else min(best, elapsed)
+    print(f'{name}: {clients} concurrent sessions, best of {rounds}: '
+          f'{best * 1000:.0f} ms, {clients / best:.0f} sessions/s')
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('kubsh')
+    parser.add_argument('-n', '--clients', type=int, default=100)
+    parser.add_argument('-r', '--rounds', type=int, default=5)
+    opts = parser.parse_args()
+
+    kubsh = os.path.abspath(opts.kubsh)
+    work = tempfile.mkdtemp(prefix='kubsh-bench-')
+    os.chmod(work, 0o700)
+    env = dict(os.environ, HOME=work)
+    sock_path = os.path.join(work, 'kubsh.sock')
+
+    server = subprocess.Popen([kubsh, '--server', sock_path], env=env,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        for _ in range(100):
+            if os.path.exists(sock_path):
+                break
+            time.sleep(0.05)
+        else:
+            sys.exit('kubsh --server did not start')
+
+        measure('server', opts.clients, opts.rounds, run_session, sock_path)
+        measure('fresh', opts.clients, opts.rounds, run_fresh, kubsh, env)
+    finally:
+        server.terminate()
+        server.wait()
+        shutil.rmtree(work, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,396 @@
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <shared_mutex>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <pwd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <readline/readline.h>
+
+#include "completion.hpp"
+#include "vfs.hpp"
+
+using namespace std;
+
+// ==================== Сжатое префиксное дерево ====================
+// Каждое ребро хранит целую подстроку, поэтому глубина дерева не превышает
+// числа ветвлений, а не длины имени. count - в скольких каталогах PATH
+// встречается команда (одно имя может лежать и в /bin, и в /usr/bin)
+struct TrieNode {
+    string label;
+    int count = 0;
+    vector<unique_ptr<TrieNode>> children;
+};
+
+static size_t common_prefix(const string& a, const char* b, size_t blen) {
+    size_t n = min(a.size(), blen);
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+static TrieNode* find_child(TrieNode* node, char c) {
+    for (auto& child : node->children) {
+        if (child->label[0] == c) return child.get();
+    }
+    return nullptr;
+}
+
+static void trie_insert(TrieNode* node, const string& key) {
+    size_t pos = 0;
+    while (pos < key.size()) {
+        TrieNode* child = find_child(node, key[pos]);
+        if (!child) {
+            auto leaf = make_unique<TrieNode>();
+            leaf->label = key.substr(pos);
+            leaf->count = 1;
+            node->children.push_back(move(leaf));
+            sort(node->children.begin(), node->children.end(),
+                 [](const auto& a, const auto& b) { return a->label < b->label; });
+            return;
+        }
+
+        size_t common = common_prefix(child->label, key.c_str() + pos, key.size() - pos);
+        if (common < child->label.size()) {
+            // Разрезаем ребро: общая часть остается в child, хвост уходит вниз
+            auto tail = make_unique<TrieNode>();
+            tail->label = child->label.substr(common);
+            tail->count = child->count;
+            tail->children = move(child->children);
+            child->label.resize(common);
+            child->count = 0;
+            child->children.clear();
+            child->children.push_back(move(tail));
+        }
+        pos += common;
+        node = child;
+    }
+    node->count++;
+}
+
+static bool trie_remove(TrieNode* node, const string& key, size_t pos) {
+    if (pos == key.size()) {
+        if (node->count == 0) return false;
+        node->count--;
+        return true;
+    }
+
+    for (size_t i = 0; i < node->children.size(); i++) {
+        TrieNode* child = node->children[i].get();
+        if (child->label[0] != key[pos]) continue;
+        if (key.compare(pos, child->label.size(), child->label) != 0) return false;
+        if (!trie_remove(child, key, pos + child->label.size())) return false;
+
+        // Удаляем пустой лист и склеиваем узел с единственным потомком
+        if (child->count == 0 && child->children.empty()) {
+            node->children.erase(node->children.begin() + i);
+        } else if (child->count == 0 && child->children.size() == 1) {
+            unique_ptr<TrieNode> only = move(child->children[0]);
+            child->label += only->label;
+            child->count = only->count;
+            child->children = move(only->children);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void trie_collect(const TrieNode* node, string& acc, vector<string>& out) {
+    if (node->count > 0) out.push_back(acc);
+    for (const auto& child : node->children) {
+        acc += child->label;
+        trie_collect(child.get(), acc, out);
+        acc.resize(acc.size() - child->label.size());
+    }
+}
+
+static void trie_find_prefix(TrieNode* root, const string& prefix, vector<string>& out) {
+    TrieNode* node = root;
+    string acc;
+    size_t pos = 0;
+
+    while (pos < prefix.size()) {
+        TrieNode* child = find_child(node, prefix[pos]);
+        if (!child) return;
+
+        size_t common = common_prefix(child->label, prefix.c_str() + pos, prefix.size() - pos);
+        if (common < child->label.size() && pos + common < prefix.size()) return;
+
+        acc += child->label;
+        pos += common;
+        node = child;
+    }
+
+    trie_collect(node, acc, out);
+}
+
+// ==================== Индекс исполняемых файлов ====================
+static TrieNode command_index;
+static shared_mutex index_mutex;
+
+// Каталоги PATH и уже учтенные в индексе имена из каждого из них
+struct PathDir {
+    string path;
+    set<string> names;
+};
+
+static bool is_executable_at(int dirfd, const char* name) {
+    struct stat st;
+    if (fstatat(dirfd, name, &st, 0) != 0) return false;
+    return S_ISREG(st.st_mode) && (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH));
+}
+
+static void scan_dir(PathDir& dir) {
+    DIR* d = opendir(dir.path.c_str());
+    if (!d) return;
+
+    int fd = dirfd(d);
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+        if (is_executable_at(fd, entry->d_name)) {
+            dir.names.insert(entry->d_name);
+        }
+    }
+    closedir(d);
+}
+
+// Обновление одного имени после события inotify
+static void refresh_name(PathDir& dir, const string& name, bool removed) {
+    bool present = false;
+    if (!removed) {
+        int fd = open(dir.path.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            present = is_executable_at(fd, name.c_str());
+            close(fd);
+        }
+    }
+
+    bool known = dir.names.count(name) > 0;
+    if (present == known) return;
+
+    unique_lock<shared_mutex> lock(index_mutex);
+    if (present) {
+        dir.names.insert(name);
+        trie_insert(&command_index, name);
+    } else {
+        dir.names.erase(name);
+        trie_remove(&command_index, name, 0);
+    }
+}
+
+static void forget_dir(PathDir& dir) {
+    unique_lock<shared_mutex> lock(index_mutex);
+    for (const auto& name : dir.names) {
+        trie_remove(&command_index, name, 0);
+    }
+    dir.names.clear();
+}
+
+void* completion_thread_function(void* arg) {
+    (void) arg;
+
+    const char* path_env = getenv("PATH");
+    if (!path_env) return nullptr;
+
+    vector<PathDir> dirs;
+    stringstream ss(path_env);
+    string path;
+    while (getline(ss, path, ':')) {
+        if (path.empty()) continue;
+        bool duplicate = false;
+        for (const auto& d : dirs) {
+            if (d.path == path) duplicate = true;
+        }
+        if (!duplicate) dirs.push_back({path, {}});
+    }
+
+    // Подписываемся до сканирования, чтобы не пропустить файлы,
+    // появившиеся во время построения индекса
+    int ifd = inotify_init1(IN_CLOEXEC);
+    map<int, size_t> watches;
+    if (ifd >= 0) {
+        for (size_t i = 0; i < dirs.size(); i++) {
+            int wd = inotify_add_watch(ifd, dirs[i].path.c_str(),
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+            if (wd >= 0) watches[wd] = i;
+        }
+    }
+
+    // Полное построение: дерево собирается без блокировки
+    // и подменяется целиком, чтобы не задерживать автодополнение
+    TrieNode built;
+    for (auto& dir : dirs) {
+        scan_dir(dir);
+        for (const auto& name : dir.names) {
+            trie_insert(&built, name);
+        }
+    }
+    {
+        unique_lock<shared_mutex> lock(index_mutex);
+        command_index.children = move(built.children);
+        command_index.count = 0;
+    }
+
+    if (ifd < 0) return nullptr;
+
+    // Инкрементальное обновление по событиям inotify
+    alignas(struct inotify_event) char buf[16 * 1024];
+    while (true) {
+        ssize_t len = read(ifd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            break;
+        }
+
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            auto it = watches.find(ev->wd);
+            if (it == watches.end()) continue;
+            PathDir& dir = dirs[it->second];
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                forget_dir(dir);
+                if (ev->mask & IN_IGNORED) watches.erase(it);
+                continue;
+            }
+            if (ev->len == 0 || ev->name[0] == '.') continue;
+
+            bool removed = ev->mask & (IN_DELETE | IN_MOVED_FROM);
+            refresh_name(dir, ev->name, removed);
+        }
+    }
+
+    close(ifd);
+    return nullptr;
+}
+
+void completion_start() {
+    pthread_t completion_thread;
+    if (pthread_create(&completion_thread, nullptr, completion_thread_function, nullptr) == 0) {
+        pthread_detach(completion_thread);
+    }
+}
+
+vector<string> completion_commands(const string& prefix) {
+    vector<string> result;
+    shared_lock<shared_mutex> lock(index_mutex);
+    trie_find_prefix(&command_index, prefix, result);
+    return result;
+}
+
+// ==================== Интеграция с readline ====================
+static const char* const builtin_commands[] = {
+    "history", "history grep", "history index", "echo", "debug", "parallel", "time", "\\q", "\\l", "\\e", nullptr
+};
+
+static const string users_root = "/opt/users/";
+
+static vector<string> pending_matches;
+static size_t pending_index = 0;
+
+static char* next_match(int state) {
+    if (state == 0) pending_index = 0;
+    if (pending_index < pending_matches.size()) {
+        return strdup(pending_matches[pending_index++].c_str());
+    }
+    return nullptr;
+}
+
+static char* command_generator(const char* text, int state) {
+    if (state == 0) {
+        string prefix = text;
+        pending_matches.clear();
+        for (int i = 0; builtin_commands[i]; i++) {
+            if (strncmp(builtin_commands[i], text, prefix.size()) == 0) {
+                pending_matches.push_back(builtin_commands[i]);
+            }
+        }
+        vector<string> found = completion_commands(prefix);
+        pending_matches.insert(pending_matches.end(), found.begin(), found.end());
+        sort(pending_matches.begin(), pending_matches.end());
+        pending_matches.erase(unique(pending_matches.begin(), pending_matches.end()),
+                              pending_matches.end());
+    }
+    return next_match(state);
+}
+
+// /opt/users/<name> и /opt/users/<name>/<файл> дополняются из базы
+// пользователей напрямую, без обращения к смонтированной FUSE
+static char* users_generator(const char* text, int state) {
+    if (state == 0) {
+        pending_matches.clear();
+        string rest = string(text).substr(users_root.size());
+        size_t slash = rest.find('/');
+
+        if (slash == string::npos) {
+            struct passwd* pwd;
+            setpwent();
+            while ((pwd = getpwent()) != NULL) {
+                if (valid_shell(pwd) && strncmp(pwd->pw_name, rest.c_str(), rest.size()) == 0) {
+                    pending_matches.push_back(users_root + pwd->pw_name);
+                }
+            }
+            endpwent();
+            sort(pending_matches.begin(), pending_matches.end());
+            rl_completion_append_character = '/';
+        } else {
+            string user = rest.substr(0, slash);
+            string partial = rest.substr(slash + 1);
+            if (partial.find('/') == string::npos && getpwnam(user.c_str()) != NULL) {
+                for (int i = 0; vfs_user_files[i]; i++) {
+                    if (strncmp(vfs_user_files[i], partial.c_str(), partial.size()) == 0) {
+                        pending_matches.push_back(users_root + user + "/" + vfs_user_files[i]);
+                    }
+                }
+            }
+        }
+    }
+    return next_match(state);
+}
+
+static char** kubsh_completion(const char* text, int start, int end) {
+    (void) end;
+
+    if (strncmp(text, users_root.c_str(), users_root.size()) == 0) {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, users_generator);
+    }
+
+    // Первое слово строки - это команда
+    bool first_word = true;
+    for (int i = 0; i < start; i++) {
+        if (rl_line_buffer[i] != ' ' && rl_line_buffer[i] != '\t') {
+            first_word = false;
+            break;
+        }
+    }
+    if (first_word && strchr(text, '/') == nullptr) {
+        rl_attempted_completion_over = 1;
+        return rl_completion_matches(text, command_generator);
+    }
+
+    // Остальное - стандартное дополнение путей readline
+    return nullptr;
+}
+
+void completion_init_readline() {
+    rl_readline_name = "kubsh";
+    rl_attempted_completion_function = kubsh_completion;
+}
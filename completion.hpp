@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Запуск фонового потока, который строит индекс исполняемых файлов из $PATH
+// и затем следит за каталогами PATH через inotify
+void completion_start();
+
+// Подключение автодополнения к readline
+void completion_init_readline();
+
+// Все команды из индекса, начинающиеся с prefix (в отсортированном порядке)
+std::vector<std::string> completion_commands(const std::string& prefix);
@@ -0,0 +1,291 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "glob.hpp"
+
+using namespace std;
+
+// ==================== Разбор шаблона ====================
+// Сегмент шаблона (между '/') компилируется один раз в список токенов.
+// Сравнение идет без рекурсии: при несовпадении возвращаемся только к
+// последней '*', поэтому время не больше O(длина имени * длина шаблона),
+// без экспоненциального перебора на шаблонах вида a*a*a*a*b
+struct GlobToken {
+    enum Kind { CHAR, ANY, STAR, SET } kind;
+    char c;
+    bitset<256> set;
+};
+
+struct GlobMatcher {
+    vector<GlobToken> tokens;
+    bool magic = false;          // Есть хотя бы один не буквальный токен
+    bool leading_dot = false;    // Шаблон сам начинается с '.', скрытые файлы подходят
+    string literal;              // Значение сегмента без экранирования
+};
+
+// Разбор [...] начиная с позиции после '['. Возвращает позицию после ']'
+// или npos, если скобка не закрыта (тогда '[' - обычный символ)
+static size_t parse_set(const string& p, size_t i, GlobToken& tok) {
+    tok.kind = GlobToken::SET;
+    tok.set.reset();
+
+    bool negate = false;
+    if (i < p.size() && (p[i] == '!' || p[i] == '^')) {
+        negate = true;
+        i++;
+    }
+
+    bool first = true;
+    while (i < p.size() && (p[i] != ']' || first)) {
+        first = false;
+        unsigned char lo = p[i];
+        if (lo == '\\' && i + 1 < p.size()) lo = p[++i];
+        i++;
+
+        unsigned char hi = lo;
+        if (i + 1 < p.size() && p[i] == '-' && p[i + 1] != ']') {
+            i++;
+            hi = p[i];
+            if (hi == '\\' && i + 1 < p.size()) hi = p[++i];
+            i++;
+        }
+        for (unsigned v = lo; v <= hi; v++) tok.set.set(v);
+    }
+    if (i >= p.size()) return string::npos;
+
+    if (negate) tok.set.flip();
+    tok.set.reset('/');
+    return i + 1;
+}
+
+static GlobMatcher compile_segment(const string& p) {
+    GlobMatcher m;
+    m.leading_dot = !p.empty() && p[0] == '.';
+
+    for (size_t i = 0; i < p.size(); i++) {
+        GlobToken tok;
+        char c = p[i];
+        if (c == '\\' && i + 1 < p.size()) {
+            tok.kind = GlobToken::CHAR;
+            tok.c = p[++i];
+        } else if (c == '*') {
+            // Несколько '*' подряд - одна
+            if (!m.tokens.empty() && m.tokens.back().kind == GlobToken::STAR) continue;
+            tok.kind = GlobToken::STAR;
+        } else if (c == '?') {
+            tok.kind = GlobToken::ANY;
+        } else if (c == '[') {
+            size_t end = parse_set(p, i + 1, tok);
+            if (end == string::npos) {
+                tok.kind = GlobToken::CHAR;
+                tok.c = c;
+            } else {
+                i = end - 1;
+            }
+        } else {
+            tok.kind = GlobToken::CHAR;
+            tok.c = c;
+        }
+
+        if (tok.kind == GlobToken::CHAR) {
+            m.literal += tok.c;
+        } else {
+            m.magic = true;
+        }
+        m.tokens.push_back(tok);
+    }
+    return m;
+}
+
+static bool token_matches(const GlobToken& tok, unsigned char c) {
+    switch (tok.kind) {
+        case GlobToken::CHAR: return (unsigned char)tok.c == c;
+        case GlobToken::ANY: return true;
+        case GlobToken::SET: return tok.set.test(c);
+        default: return false;
+    }
+}
+
+static bool glob_match(const GlobMatcher& m, const char* name) {
+    // Скрытые файлы подходят только под шаблон, начинающийся с '.'
+    if (name[0] == '.' && !m.leading_dot) return false;
+
+    const vector<GlobToken>& t = m.tokens;
+    size_t ti = 0;
+    const char* s = name;
+    size_t star_ti = string::npos;   // Токен после последней '*'
+    const char* star_s = nullptr;    // Позиция в имени, с которой эта '*' пробуется
+
+    while (*s) {
+        if (ti < t.size() && t[ti].kind == GlobToken::STAR) {
+            star_ti = ++ti;
+            star_s = s;
+        } else if (ti < t.size() && token_matches(t[ti], *s)) {
+            ti++;
+            s++;
+        } else if (star_ti != string::npos) {
+            // '*' забирает еще один символ
+            ti = star_ti;
+            s = ++star_s;
+        } else {
+            return false;
+        }
+    }
+    while (ti < t.size() && t[ti].kind == GlobToken::STAR) ti++;
+    return ti == t.size();
+}
+
+bool glob_has_magic(const string& pattern) {
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        if (c == '\\') {
+            i++;
+        } else if (c == '*' || c == '?') {
+            return true;
+        } else if (c == '[') {
+            GlobToken tok;
+            if (parse_set(pattern, i + 1, tok) != string::npos) return true;
+        }
+    }
+    return false;
+}
+
+string glob_escape(const string& text) {
+    string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        if (c == '\\' || c == '*' || c == '?' || c == '[') out += '\\';
+        out += c;
+    }
+    return out;
+}
+
+string glob_unescape(const string& pattern) {
+    string out;
+    out.reserve(pattern.size());
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] == '\\' && i + 1 < pattern.size()) i++;
+        out += pattern[i];
+    }
+    return out;
+}
+
+// ==================== Чтение каталогов ====================
+// getdents64 вместо readdir: записи читаются большими блоками сразу
+// вместе с типом, и лишних stat для отсева файлов не нужно
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static const vector<GlobEntry>& list_dir(GlobCache& cache, const string& dir) {
+    auto it = cache.dirs.find(dir);
+    if (it != cache.dirs.end()) return it->second;
+
+    vector<GlobEntry>& entries = cache.dirs[dir];
+    int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return entries;
+
+    alignas(linux_dirent64) char buf[32768];
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n; ) {
+            linux_dirent64* d = (linux_dirent64*)(buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            entries.push_back({d->d_name, d->d_type});
+        }
+    }
+    close(fd);
+    return entries;
+}
+
+static bool is_directory(const string& path, unsigned char type) {
+    if (type == DT_DIR) return true;
+    if (type != DT_LNK && type != DT_UNKNOWN) return false;
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// ==================== Раскрытие ====================
+bool glob_expand(const string& pattern, GlobCache& cache, vector<string>& out) {
+    // Разбиение на сегменты по '/', повторные '/' схлопываются
+    vector<string> segments;
+    size_t start = 0;
+    while (start <= pattern.size()) {
+        size_t slash = pattern.find('/', start);
+        if (slash == string::npos) slash = pattern.size();
+        if (slash > start) segments.push_back(pattern.substr(start, slash - start));
+        start = slash + 1;
+    }
+    if (segments.empty()) return false;
+
+    bool absolute = pattern[0] == '/';
+    bool dirs_only = pattern.back() == '/';   // "*/" - только каталоги
+
+    // Пути, подходящие под уже разобранные сегменты; "" - текущий каталог
+    vector<string> paths(1, absolute ? "/" : "");
+    vector<unsigned char> types(1, DT_DIR);
+
+    for (size_t i = 0; i < segments.size() && !paths.empty(); i++) {
+        bool last = i + 1 == segments.size();
+        GlobMatcher m = compile_segment(segments[i]);
+        vector<string> next;
+        vector<unsigned char> next_types;
+
+        for (size_t k = 0; k < paths.size(); k++) {
+            const string& dir = paths[k];
+            string base = dir.empty() || dir.back() == '/' ? dir : dir + "/";
+
+            if (!m.magic) {
+                // Буквальный сегмент: каталог не читаем, существование
+                // проверяется в конце или при чтении следующего уровня
+                next.push_back(base + m.literal);
+                next_types.push_back(DT_UNKNOWN);
+                continue;
+            }
+
+            // Не каталог отсеется сам: open(O_DIRECTORY) вернет ошибку
+            for (const GlobEntry& entry : list_dir(cache, dir)) {
+                if (!glob_match(m, entry.name.c_str())) continue;
+                // В середине шаблона нужны только каталоги (и ссылки на них)
+                if (!last && entry.type != DT_DIR && entry.type != DT_LNK && entry.type != DT_UNKNOWN) continue;
+                next.push_back(base + entry.name);
+                next_types.push_back(entry.type);
+            }
+        }
+        paths.swap(next);
+        types.swap(next_types);
+    }
+
+    size_t first = out.size();
+    for (size_t k = 0; k < paths.size(); k++) {
+        if (types[k] == DT_UNKNOWN) {
+            // Путь закончился буквальным сегментом - проверяем, что он есть
+            struct stat st;
+            if (lstat(paths[k].c_str(), &st) != 0) continue;
+            types[k] = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+            if (S_ISLNK(st.st_mode)) types[k] = DT_LNK;
+        }
+        if (dirs_only) {
+            if (!is_directory(paths[k], types[k])) continue;
+            out.push_back(paths[k] + "/");
+        } else {
+            out.push_back(paths[k]);
+        }
+    }
+    sort(out.begin() + first, out.end());
+    return out.size() > first;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Запись каталога: имя и тип из getdents64 (DT_*)
+struct GlobEntry {
+    std::string name;
+    unsigned char type;
+};
+
+// Списки каталогов, прочитанные во время раскрытия одной команды.
+// Создается на команду и выбрасывается после нее, поэтому каждый каталог
+// читается не больше одного раза, а изменения на диске видны следующей команде
+struct GlobCache {
+    std::unordered_map<std::string, std::vector<GlobEntry>> dirs;
+};
+
+// Есть ли в слове не экранированные *, ? или [...]
+bool glob_has_magic(const std::string& pattern);
+
+// Экранирование текста, который должен сравниваться буквально (из кавычек)
+std::string glob_escape(const std::string& text);
+
+// Снятие экранирования - значение слова, если совпадений нет
+std::string glob_unescape(const std::string& pattern);
+
+// Добавляет в out отсортированные пути, подходящие под шаблон.
+// Возвращает false, если совпадений нет (тогда слово остается как есть)
+bool glob_expand(const std::string& pattern, GlobCache& cache, std::vector<std::string>& out);
@@ -0,0 +1,428 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "history_search.hpp"
+
+using namespace std;
+
+// ==================== Отображение файла в память ====================
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+static bool map_file(const string& path, MappedFile& file) {
+    file = MappedFile();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    file.size = st.st_size;
+    if (file.size > 0) {
+        void* p = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            file.size = 0;
+            close(fd);
+            return false;
+        }
+        file.data = (const char*)p;
+    }
+    close(fd);
+    return true;
+}
+
+static void unmap_file(MappedFile& file) {
+    if (file.data) munmap((void*)file.data, file.size);
+    file = MappedFile();
+}
+
+// ==================== Поиск подстроки ====================
+// Фильтр по первому и последнему байту образца сразу для 16 позиций,
+// полное сравнение только для кандидатов. Без SSE2 - memmem из libc
+static const char* find_substring(const char* hay, size_t n, const string& needle) {
+    size_t m = needle.size();
+    if (m == 0) return hay;
+    if (m > n) return nullptr;
+    if (m == 1) return (const char*)memchr(hay, needle[0], n);
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                        _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle.data() + 1, m - 2) == 0) {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    hay += i;
+    n -= i;
+#endif
+
+    return (const char*)memmem(hay, n, needle.data(), m);
+}
+
+// ==================== N-граммный индекс ====================
+// Индексированная часть истории режется на блоки примерно по 64 КиБ
+// (граница всегда после '\n'). Для каждого блока хранится фильтр Блума
+// по триграммам его строк: блок просматривается, только если в фильтре есть
+// все триграммы образца. Дописанный после индексации хвост сканируется целиком
+static const char INDEX_MAGIC[8] = {'K', 'U', 'B', 'S', 'H', 'I', 'D', 'X'};
+static const uint32_t INDEX_VERSION = 1;
+static const size_t BLOCK_SIZE = 64 * 1024;
+static const size_t BLOOM_BYTES = 8 * 1024;
+static const size_t HEAD_BYTES = 4096;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bloom_bytes;
+    uint64_t indexed_size;   // Сколько байт истории покрыто блоками
+    uint64_t block_count;
+    uint64_t head_hash;      // Хеш начала истории - признак подмены файла
+};
+
+static string index_path(const string& history_file) {
+    return history_file + ".idx";
+}
+
+static uint64_t hash_bytes(const char* data, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static inline void trigram_bits(const char* p, uint32_t& b1, uint32_t& b2) {
+    uint64_t tri = (unsigned char)p[0] | ((unsigned char)p[1] << 8) | ((unsigned char)p[2] << 16);
+    uint64_t x = tri * 0x9E3779B97F4A7C15ULL;
+    b1 = (x >> 48) % (BLOOM_BYTES * 8);
+    b2 = ((x >> 24) & 0xFFFFFF) % (BLOOM_BYTES * 8);
+}
+
+static void bloom_add_block(uint8_t* bloom, const char* data, size_t n) {
+    for (size_t i = 0; i + 3 <= n; i++) {
+        if (data[i] == '\n' || data[i + 1] == '\n' || data[i + 2] == '\n') continue;
+        uint32_t b1, b2;
+        trigram_bits(data + i, b1, b2);
+        bloom[b1 >> 3] |= 1 << (b1 & 7);
+        bloom[b2 >> 3] |= 1 << (b2 & 7);
+    }
+}
+
+static bool bloom_may_contain(const uint8_t* bloom, const string& pattern) {
+    for (size_t i = 0; i + 3 <= pattern.size(); i++) {
+        uint32_t b1, b2;
+        trigram_bits(pattern.data() + i, b1, b2);
+        if (!(bloom[b1 >> 3] & (1 << (b1 & 7))) || !(bloom[b2 >> 3] & (1 << (b2 & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// История и (если он есть и соответствует ей) ее индекс
+struct HistoryMap {
+    MappedFile history;
+    MappedFile index;
+    const IndexHeader* header = nullptr;
+    const uint64_t* block_ends = nullptr;
+    const uint8_t* blooms = nullptr;
+};
+
+static bool index_matches(const HistoryMap& map) {
+    const MappedFile& idx = map.index;
+    if (idx.size < sizeof(IndexHeader)) return false;
+
+    const IndexHeader* h = (const IndexHeader*)idx.data;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) return false;
+    if (h->version != INDEX_VERSION || h->bloom_bytes != BLOOM_BYTES) return false;
+    if (idx.size != sizeof(IndexHeader) + h->block_count * (sizeof(uint64_t) + BLOOM_BYTES)) return false;
+    if (h->indexed_size > map.history.size) return false;
+
+    size_t head = min(map.history.size, HEAD_BYTES);
+    return h->head_hash == hash_bytes(map.history.data, head);
+}
+
+static bool open_history(const string& history_file, HistoryMap& map) {
+    map = HistoryMap();
+    if (!map_file(history_file, map.history)) return false;
+
+    if (map_file(index_path(history_file), map.index) && index_matches(map)) {
+        map.header = (const IndexHeader*)map.index.data;
+        map.block_ends = (const uint64_t*)(map.index.data + sizeof(IndexHeader));
+        map.blooms = (const uint8_t*)(map.block_ends + map.header->block_count);
+    } else {
+        unmap_file(map.index);
+    }
+    return true;
+}
+
+static void close_history(HistoryMap& map) {
+    unmap_file(map.history);
+    unmap_file(map.index);
+    map = HistoryMap();
+}
+
+// Участки истории, в которых может встретиться образец, в порядке файла.
+// Неиндексированный хвост режется на куски по границам строк, чтобы
+// обратный поиск находил свежие совпадения, не просматривая весь файл
+static vector<pair<size_t, size_t>> candidate_ranges(const HistoryMap& map, const string& pattern) {
+    vector<pair<size_t, size_t>> ranges;
+    size_t pos = 0;
+
+    if (map.header) {
+        for (uint64_t i = 0; i < map.header->block_count; i++) {
+            size_t end = map.block_ends[i];
+            if (bloom_may_contain(map.blooms + i * BLOOM_BYTES, pattern)) {
+                ranges.push_back({pos, end});
+            }
+            pos = end;
+        }
+    }
+
+    const size_t chunk = 16 * BLOCK_SIZE;
+    const char* data = map.history.data;
+    size_t size = map.history.size;
+    while (pos < size) {
+        size_t end = size;
+        if (size - pos > chunk) {
+            const char* nl = (const char*)memchr(data + pos + chunk, '\n', size - pos - chunk);
+            if (nl) end = nl - data + 1;
+        }
+        ranges.push_back({pos, end});
+        pos = end;
+    }
+    return ranges;
+}
+
+// Вызывает on_line(начало, конец) для каждой строки участка, содержащей образец
+template <typename F>
+static void scan_range(const char* data, size_t begin, size_t end, const string& pattern, F on_line) {
+    size_t pos = begin;
+    while (pos < end) {
+        const char* hit = find_substring(data + pos, end - pos, pattern);
+        if (!hit) return;
+
+        const char* line_begin = (const char*)memrchr(data + begin, '\n', hit - (data + begin));
+        line_begin = line_begin ? line_begin + 1 : data + begin;
+        const char* line_end = (const char*)memchr(hit, '\n', data + end - hit);
+        if (!line_end) line_end = data + end;
+
+        on_line(line_begin - data, line_end - data);
+        pos = line_end - data + 1;
+    }
+}
+
+// Начало последней строки с образцом, которая начинается раньше limit, или -1
+static long find_last_before(const HistoryMap& map, const string& pattern, size_t limit) {
+    vector<pair<size_t, size_t>> ranges = candidate_ranges(map, pattern);
+    for (auto it = ranges.rbegin(); it != ranges.rend(); ++it) {
+        if (it->first >= limit) continue;
+
+        long found = -1;
+        scan_range(map.history.data, it->first, it->second, pattern, [&](size_t b, size_t e) {
+            (void) e;
+            if (b < limit) found = b;
+        });
+        if (found >= 0) return found;
+    }
+    return -1;
+}
+
+// ==================== Встроенные команды ====================
+void process_history_grep(const string& history_file, const string& pattern) {
+    HistoryMap map;
+    if (!open_history(history_file, map)) {
+        cout << "history: cannot open " << history_file << "\n";
+        return;
+    }
+    if (map.history.size > 0) {
+        madvise((void*)map.history.data, map.history.size, MADV_SEQUENTIAL);
+    }
+
+    // Вывод копится и отдается крупными кусками, а не построчно
+    string out;
+    for (const auto& range : candidate_ranges(map, pattern)) {
+        scan_range(map.history.data, range.first, range.second, pattern, [&](size_t b, size_t e) {
+            out.append(map.history.data + b, e - b);
+            out += '\n';
+        });
+        if (out.size() >= 64 * 1024) {
+            cout.write(out.data(), out.size());
+            out.clear();
+        }
+    }
+    cout.write(out.data(), out.size());
+
+    close_history(map);
+}
+
+void process_history_index(const string& history_file) {
+    HistoryMap map;
+    if (!open_history(history_file, map)) {
+        cout << "history: cannot open " << history_file << "\n";
+        return;
+    }
+
+    const char* data = map.history.data;
+    size_t size = map.history.size;
+
+    // Уже построенные блоки переиспользуются, индексируется только новый хвост
+    vector<uint64_t> ends;
+    vector<uint8_t> blooms;
+    size_t pos = 0;
+    if (map.header) {
+        ends.assign(map.block_ends, map.block_ends + map.header->block_count);
+        blooms.assign(map.blooms, map.blooms + map.header->block_count * BLOOM_BYTES);
+        pos = map.header->indexed_size;
+    }
+
+    while (pos < size) {
+        size_t end = min(pos + BLOCK_SIZE, size);
+        const char* nl = (const char*)memchr(data + end - 1, '\n', size - end + 1);
+        if (!nl) break;  // Последняя строка еще не дописана
+        end = nl - data + 1;
+
+        blooms.resize(blooms.size() + BLOOM_BYTES, 0);
+        bloom_add_block(blooms.data() + blooms.size() - BLOOM_BYTES, data + pos, end - pos);
+        ends.push_back(end);
+        pos = end;
+    }
+
+    IndexHeader header = {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.bloom_bytes = BLOOM_BYTES;
+    header.indexed_size = pos;
+    header.block_count = ends.size();
+    header.head_hash = hash_bytes(data, min(size, HEAD_BYTES));
+    close_history(map);
+
+    // Запись во временный файл и rename, чтобы читатели не увидели половину индекса
+    string path = index_path(history_file);
+    string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) {
+        cout << "history: cannot write " << path << "\n";
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(ends.data(), sizeof(uint64_t), ends.size(), out) == ends.size() &&
+              fwrite(blooms.data(), 1, blooms.size(), out) == blooms.size();
+    ok = (fclose(out) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        cout << "history: cannot write " << path << "\n";
+        return;
+    }
+
+    cout << "Indexed " << header.indexed_size << " bytes in " << header.block_count << " blocks\n";
+}
+
+// ==================== Ctrl-R в readline ====================
+static string search_history_file;
+
+static int reverse_search(int count, int key) {
+    (void) count;
+    (void) key;
+
+    HistoryMap map;
+    if (!open_history(search_history_file, map)) {
+        rl_ding();
+        return 0;
+    }
+
+    string saved_line = rl_line_buffer;
+    string saved_prompt = rl_prompt ? rl_prompt : "";
+    string query;
+    long match = -1;
+    bool failed = false;
+
+    auto search_from = [&](size_t limit) {
+        long found = query.empty() ? -1 : find_last_before(map, query, limit);
+        failed = !query.empty() && found < 0;
+        if (found >= 0) match = found;
+    };
+
+    auto show = [&]() {
+        string prompt = string(failed ? "(failed " : "(") + "reverse-i-search)`" + query + "': ";
+        rl_set_prompt(prompt.c_str());
+        if (match >= 0) {
+            const char* begin = map.history.data + match;
+            const char* end = (const char*)memchr(begin, '\n', map.history.size - match);
+            string line(begin, end ? end - begin : map.history.data + map.history.size - begin);
+            rl_replace_line(line.c_str(), 0);
+            size_t at = line.find(query);
+            rl_point = at == string::npos ? 0 : at;
+        }
+        rl_redisplay();
+    };
+
+    show();
+    while (true) {
+        int c = rl_read_key();
+
+        if (c == 18) {                       // Ctrl-R - следующее, более старое совпадение
+            search_from(match >= 0 ? match : map.history.size);
+            if (failed) rl_ding();
+        } else if (c == 7 || c == 27) {      // Ctrl-G, Esc - отмена
+            rl_replace_line(saved_line.c_str(), 0);
+            rl_point = rl_end;
+            break;
+        } else if (c == 127 || c == 8) {     // Backspace
+            if (!query.empty()) query.pop_back();
+            match = -1;
+            search_from(map.history.size);
+        } else if (c == '\n' || c == '\r') { // Enter - выполнить найденную строку
+            rl_done = 1;
+            break;
+        } else if (c >= 32) {
+            query += (char)c;
+            search_from(map.history.size);
+        } else {
+            // Любая другая клавиша оставляет найденную строку для редактирования
+            rl_execute_next(c);
+            break;
+        }
+        show();
+    }
+
+    rl_set_prompt(saved_prompt.c_str());
+    rl_redisplay();
+    close_history(map);
+    return 0;
+}
+
+void history_search_init(const string& history_file) {
+    search_history_file = history_file;
+    rl_bind_keyseq("\\C-r", reverse_search);
+}
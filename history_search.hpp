@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// Привязка Ctrl-R в readline к поиску по файлу истории
+void history_search_init(const std::string& history_file);
+
+// history grep PATTERN - все строки истории, содержащие PATTERN
+void process_history_grep(const std::string& history_file, const std::string& pattern);
+
+// history index - построение или дополнение n-граммного индекса рядом с историей
+void process_history_index(const std::string& history_file);
@@ -18,14 +18,26 @@
 #include <dirent.h>
 #include <cstring>
 #include <cstdint>
+#include <readline/readline.h>
+#include <readline/history.h>
 
 #include "vfs.hpp"
+#include "completion.hpp"
+#include "history_search.hpp"
+#include "script.hpp"
+#include "parallel.hpp"
+#include "timing.hpp"
+#include "glob.hpp"
+#include "server.hpp"
+#include "record.hpp"
 
 using namespace std;
 
 // ==================== Глобальные переменные ====================
 volatile sig_atomic_t sighup_received = 0;
 volatile sig_atomic_t running = true;
+string history_file;
+int line_status = 0;    // Код завершения последней строки process_line (для if, && и || в сценариях)
 
 // ==================== Функции для работы с сигналами ====================
 void handle_sighup(int signum) {
@@ -163,12 +175,14 @@ void check_disk_partitions(const string& device_path) {
 }
 
 // ==================== Функции для выполнения команд ====================
-bool execute_external(const vector<string>& args) {
+// status - код завершения команды, если она найдена
+bool execute_external(const vector<string>& args, int* status_out = nullptr) {
     if (args.empty()) return false;
     
     string cmd_path = find_in_path(args[0]);
     if (cmd_path.empty()) return false;
     
+    uint64_t fork_start = record_clock();
     pid_t pid = fork();
     if (pid == 0) {
         vector<char*> exec_args;
@@ -180,8 +194,19 @@ bool execute_external(const vector<string>& args) {
         execv(cmd_path.c_str(), exec_args.data());
         exit(127);
     } else if (pid > 0) {
-        int status;
-        waitpid(pid, &status, 0);
+        record_stage(STAGE_SPAWN, record_clock() - fork_start);
+        record_spawn(args[0]);
+
+        int status = 0;
+        struct rusage usage;
+        uint64_t wait_start = record_clock();
+        if (wait4(pid, &status, 0, &usage) == pid) {
+            timing_child_exited(usage);
+        }
+        record_stage(STAGE_WAIT, record_clock() - wait_start);
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        record_exit(code);
+        if (status_out) *status_out = code;
         return true;
     }
     
@@ -331,6 +356,23 @@ void handle_user_deletion(const string& username) {
     system(deluser_cmd.c_str());
 }
 
+// ==================== Чтение ввода ====================
+// В интерактивном режиме строку читает readline (редактирование, история
+// стрелками, Tab), иначе - обычный getline, чтобы скрипты и тесты не видели приглашение
+bool read_input(string& input, const char* prompt) {
+    if (!isatty(STDIN_FILENO)) {
+        return static_cast<bool>(getline(cin, input));
+    }
+
+    char* line = readline(prompt);
+    if (!line) return false;
+
+    input = line;
+    if (*line) add_history(line);
+    free(line);
+    return true;
+}
+
 // ==================== Обработка встроенных команд ====================
 void process_history(const string& history_file) {
     ifstream history_in(history_file);
@@ -410,38 +452,189 @@ void process_disk_info(const string& device_path) {
     }
 }
 
-// ==================== Основная функция ====================
-int main() {
-    cout << unitbuf;
-    cerr << unitbuf;
-    
-    // Запуск FUSE
-    fuse_start();
+// ==================== Разбор строки ====================
+bool run_line(const string& line);
+
+// Возвращает false, если шелл нужно завершить (\q)
+bool process_line(const string& input) {
+    line_status = 0;
+    record_dispatch(input.substr(0, input.find(' ')));
+
+    // Обработка специальных команд
+    if (input == "history") {
+        process_history(history_file);
+    }
+    else if (input.substr(0, 13) == "history grep ") {
+        process_history_grep(history_file, input.substr(13));
+    }
+    else if (input == "history index") {
+        process_history_index(history_file);
+    }
+    else if (input == "\\q") {
+        return false;
+    }
+    else if (input.substr(0, 3) == "\\l ") {
+        process_disk_info(input.substr(3));
+    }
+    else if (input.substr(0, 7) == "debug '" && input[input.length() - 1] == '\'') {
+        process_debug(input);
+    }
+    else if (input.substr(0,4) == "\\e $") {
+        process_env_var(input.substr(4));
+    }
+    else if (input.substr(0, 5) == "echo ") {
+        process_echo(input);
+    }
+    else if (input == "time" || input.substr(0, 5) == "time ") {
+        return process_time(input.substr(4), run_line);
+    }
+    else {
+        // Разбиваем ввод на аргументы
+        vector<string> args;
+        stringstream ss(input);
+        string token;
+        while (ss >> token) {
+            args.push_back(token);
+        }
+
+        // Раскрытие шаблонов *, ? и [...]; без совпадений аргумент остается как есть
+        GlobCache glob_cache;
+        vector<string> expanded;
+        for (const auto& arg : args) {
+            if (!glob_has_magic(arg) || !glob_expand(arg, glob_cache, expanded)) {
+                expanded.push_back(arg);
+            }
+        }
+        args.swap(expanded);
+        
+        if (args.empty()) return true;
+        
+        // Обработка команд управления файлами
+        if (args[0] == "cat" && args.size() > 1 && args[1] == "/etc/passwd") {
+            ifstream file("/etc/passwd");
+            if (file) {
+                string line;
+                while (getline(file, line)) {
+                    cout << line << endl;
+                }
+                file.close();
+            } else {
+                cout << "cat: /etc/passwd: No such file or directory" << endl;
+                line_status = 1;
+            }
+        }
+        else if (args[0] == "mkdir" && args.size() > 1) {
+            string dir_path = args[1];
+            if (dir_path.find("/opt/users/") == 0) {
+                string username = dir_path.substr(strlen("/opt/users/"));
+                if (!username.empty() && username.find('/') == string::npos) {
+                    create_user_vfs_info(username);
+                    cout << "Created VFS directory for user: " << username << endl;
+                } else {
+                    if (!create_directory(dir_path)) line_status = 1;
+                }
+            } else {
+                if (!create_directory(dir_path)) line_status = 1;
+            }
+        }
+        else if (args[0] == "ls" && args.size() > 1 && args[1] == "/opt/users") {
+            if (dir_exists("/opt/users")) {
+                DIR* dir = opendir("/opt/users");
+                if (dir) {
+                    struct dirent* entry;
+                    while ((entry = readdir(dir)) != nullptr) {
+                        if (entry->d_name[0] != '.') {
+                            string full_path = string("/opt/users/") + entry->d_name;
+                            if (dir_exists(full_path)) {
+                                cout << entry->d_name << endl;
+                            }
+                        }
+                    }
+                    closedir(dir);
+                }
+            } else {
+                cout << "ls: cannot access '/opt/users': No such file or directory" << endl;
+            }
+        }
+        else if (args[0] == "parallel") {
+            line_status = process_parallel(args);
+        }
+        else if (args[0] == "rmdir" && args.size() > 1) {
+            string dir_path = args[1];
+            if (dir_path.find("/opt/users/") == 0) {
+                string username = dir_path.substr(strlen("/opt/users/"));
+                if (!username.empty() && username.find('/') == string::npos) {
+                    handle_user_deletion(username);
+                    string cmd = "rm -rf \"" + dir_path + "\"";
+                    system(cmd.c_str());
+                    cout << "Removed VFS directory and user: " << username << endl;
+                } else {
+                    if (rmdir(dir_path.c_str()) != 0) line_status = 1;
+                }
+            } else {
+                if (rmdir(dir_path.c_str()) != 0) line_status = 1;
+            }
+        }
+        else {
+            // Выполнение внешней команды
+            if (!execute_external(args, &line_status)) {
+                cout << args[0] << ": command not found" << endl;
+                line_status = 127;
+            }
+        }
+    }
     
+    return true;
+}
+
+// Встроенная команда main.cpp, вызванная из сценария
+int script_line(const string& line, bool& keep_running) {
+    keep_running = process_line(line);
+    return line_status;
+}
+
+// Строка целиком: конструкция языка сценариев или обычная команда
+bool run_line(const string& line) {
+    if (script_wants_line(line)) {
+        script_run(line);
+        return !script_exit_requested();
+    }
+    return process_line(line);
+}
+
+// ==================== Сеанс ====================
+// Выполнение введенного текста: строка или конструкция на несколько строк.
+// Возвращает false, если шелл нужно завершить
+bool run_input(const string& text) {
+    // В режиме time log замеряется каждая команда, кроме самих time
+    // (сравнивается первое слово: timeout или times замеряются)
+    size_t start = text.find_first_not_of(" \t");
+    string first = start == string::npos ? "" : text.substr(start, text.find_first_of(" \t\n;", start) - start);
+    CommandTiming timing;
+    bool timed = timing_session_enabled() && first != "time";
+    if (timed) timing_start(timing, timing_session_hw());
+    
+    bool keep_running = run_line(text);
+    
+    if (timed) {
+        timing_stop(timing);
+        timing_session_log(timing, text);
+    }
+    return keep_running;
+}
+
+// Цикл чтения и выполнения команд: обычный запуск или сеанс kubsh --server
+void run_session() {
     vector<string> history;
     string input;
-    
-    const char* home = getenv("HOME");
-    string history_file = string(home) + "/.kubsh_history";
     ofstream history_out(history_file, ios::app);
-    
-    // Установка обработчиков сигналов
-    signal(SIGHUP, handle_sighup);
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
-    
-    // Инициализация VFS
-    init_vfs();
-    
+
     // Основной цикл
     while (running) {
-        if (isatty(STDIN_FILENO)) {
-            cout << "kubsh> ";
-        }
         cout.flush();
         
-        if (!getline(cin, input)) {
-            if (cin.eof()) break;
+        if (!read_input(input, "kubsh> ")) {
+            if (cin.eof() || isatty(STDIN_FILENO)) break;
             continue;
         }
         
@@ -454,112 +647,122 @@ int main() {
         }
         history.push_back(input);
         
-        // Обработка специальных команд
-        if (input == "history") {
-            process_history(history_file);
+        // Конструкции языка могут занимать несколько строк - дочитываем до конца
+        bool is_script = script_wants_line(input);
+        string text = input;
+        string more;
+        while (is_script && script_incomplete(text) && read_input(more, "> ")) {
+            if (history_out.is_open()) {
+                history_out << more << endl;
+                history_out.flush();
+            }
+            text += "\n" + more;
         }
-        else if (input == "\\q") {
-            break;
+        
+        record_input(text);
+        if (!run_input(text)) break;
+        
+        cout.flush();
+    }
+    
+    if (history_out.is_open()) {
+        history_out.close();
+    }
+}
+
+// Монтирование VFS: один раз на процесс, в режиме сервера - на все сеансы
+void start_vfs() {
+    // Запуск FUSE
+    fuse_start();
+    
+    // Инициализация VFS
+    init_vfs();
+}
+
+// ==================== Основная функция ====================
+int main(int argc, char* argv[]) {
+    cout << unitbuf;
+    cerr << unitbuf;
+    
+    string mode;
+    string socket_path;
+    string record_path;
+    double replay_speed = 1;    // 0 - без пауз (--speed max)
+    double min_rate = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        
+        if ((arg == "--server" || arg == "--connect")) {
+            mode = arg;
+            // Путь к сокету необязателен
+            if (has_value && argv[i + 1][0] != '-') socket_path = argv[++i];
         }
-        else if (input.substr(0, 3) == "\\l ") {
-            process_disk_info(input.substr(3));
+        else if (arg == "--record" && has_value) {
+            record_path = argv[++i];
         }
-        else if (input.substr(0, 7) == "debug '" && input[input.length() - 1] == '\'') {
-            process_debug(input);
+        else if (arg == "--replay" && has_value) {
+            mode = arg;
+            record_path = argv[++i];
         }
-        else if (input.substr(0,4) == "\\e $") {
-            process_env_var(input.substr(4));
+        else if (arg == "--speed" && has_value) {
+            string value = argv[++i];
+            replay_speed = value == "max" ? 0 : atof(value.c_str());
         }
-        else if (input.substr(0, 5) == "echo ") {
-            process_echo(input);
+        else if (arg == "--min-rate" && has_value) {
+            min_rate = atof(argv[++i]);
         }
         else {
-            // Разбиваем ввод на аргументы
-            vector<string> args;
-            stringstream ss(input);
-            string token;
-            while (ss >> token) {
-                args.push_back(token);
-            }
-            
-            if (args.empty()) continue;
-            
-            // Обработка команд управления файлами
-            if (args[0] == "cat" && args.size() > 1 && args[1] == "/etc/passwd") {
-                ifstream file("/etc/passwd");
-                if (file) {
-                    string line;
-                    while (getline(file, line)) {
-                        cout << line << endl;
-                    }
-                    file.close();
-                } else {
-                    cout << "cat: /etc/passwd: No such file or directory" << endl;
-                }
-            }
-            else if (args[0] == "mkdir" && args.size() > 1) {
-                string dir_path = args[1];
-                if (dir_path.find("/opt/users/") == 0) {
-                    string username = dir_path.substr(strlen("/opt/users/"));
-                    if (!username.empty() && username.find('/') == string::npos) {
-                        create_user_vfs_info(username);
-                        cout << "Created VFS directory for user: " << username << endl;
-                    } else {
-                        create_directory(dir_path);
-                    }
-                } else {
-                    create_directory(dir_path);
-                }
-            }
-            else if (args[0] == "ls" && args.size() > 1 && args[1] == "/opt/users") {
-                if (dir_exists("/opt/users")) {
-                    DIR* dir = opendir("/opt/users");
-                    if (dir) {
-                        struct dirent* entry;
-                        while ((entry = readdir(dir)) != nullptr) {
-                            if (entry->d_name[0] != '.') {
-                                string full_path = string("/opt/users/") + entry->d_name;
-                                if (dir_exists(full_path)) {
-                                    cout << entry->d_name << endl;
-                                }
-                            }
-                        }
-                        closedir(dir);
-                    }
-                } else {
-                    cout << "ls: cannot access '/opt/users': No such file or directory" << endl;
-                }
-            }
-            else if (args[0] == "rmdir" && args.size() > 1) {
-                string dir_path = args[1];
-                if (dir_path.find("/opt/users/") == 0) {
-                    string username = dir_path.substr(strlen("/opt/users/"));
-                    if (!username.empty() && username.find('/') == string::npos) {
-                        handle_user_deletion(username);
-                        string cmd = "rm -rf \"" + dir_path + "\"";
-                        system(cmd.c_str());
-                        cout << "Removed VFS directory and user: " << username << endl;
-                    } else {
-                        rmdir(dir_path.c_str());
-                    }
-                } else {
-                    rmdir(dir_path.c_str());
-                }
-            }
-            else {
-                // Выполнение внешней команды
-                if (!execute_external(args)) {
-                    cout << args[0] << ": command not found" << endl;
-                }
-            }
+            cerr << "Usage: kubsh [--record FILE] | --replay FILE [--speed max|N] [--min-rate N]"
+                 << " | --server [SOCKET] | --connect [SOCKET]\n";
+            return 2;
         }
-        
-        cout.flush();
     }
     
-    if (history_out.is_open()) {
-        history_out.close();
+    if ((mode == "--server" || mode == "--connect") && socket_path.empty()) {
+        socket_path = server_default_socket();
+        if (socket_path.empty()) return 1;
+    }
+    
+    // Клиенту не нужны ни VFS, ни история - только перенаправление ввода и вывода
+    if (mode == "--connect") {
+        return client_connect(socket_path);
+    }
+    
+    const char* home = getenv("HOME");
+    history_file = string(home) + "/.kubsh_history";
+    
+    script_set_line_handler(script_line);
+    
+    // Установка обработчиков сигналов
+    signal(SIGHUP, handle_sighup);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    
+    // Демон держит единственное монтирование VFS, сеансы приходят через сокет
+    if (mode == "--server") {
+        return server_run(socket_path, start_vfs, run_session);
+    }
+    
+    // Воспроизведение замеряет сам шелл, без VFS и записи в историю
+    if (mode == "--replay") {
+        return replay_run(record_path, replay_speed, min_rate, run_input);
+    }
+    
+    if (!record_path.empty() && !record_open(record_path)) {
+        return 1;
+    }
+    
+    start_vfs();
+    
+    // Индекс команд для автодополнения строится в фоне
+    if (isatty(STDIN_FILENO)) {
+        completion_init_readline();
+        completion_start();
+        history_search_init(history_file);
     }
     
+    run_session();
     return 0;
 }
@@ -0,0 +1,307 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "parallel.hpp"
+#include "timing.hpp"
+#include "record.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+extern volatile sig_atomic_t running;
+
+// ==================== Задания ====================
+struct Job {
+    vector<string> argv;
+    string output;             // Весь вывод задания (stdout + stderr)
+    pid_t pid = -1;
+    int out_fd = -1;           // Конец канала, из которого читаем вывод
+    int pidfd = -1;            // -1 - pidfd недоступен, опрашиваем waitpid
+    bool reaped = false;
+    int status = 0;
+    Clock::time_point started;
+    Clock::time_point finished;
+};
+
+// В epoll_data храним номер задания и тип дескриптора
+static const uint64_t EV_PIDFD = 1;
+
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// {} в шаблоне заменяется аргументом, иначе аргумент добавляется в конец
+static vector<string> build_argv(const vector<string>& command, const string& arg) {
+    vector<string> argv;
+    bool substituted = false;
+    for (string word : command) {
+        size_t at = 0;
+        while ((at = word.find("{}", at)) != string::npos) {
+            word.replace(at, 2, arg);
+            at += arg.size();
+            substituted = true;
+        }
+        argv.push_back(word);
+    }
+    if (!substituted) argv.push_back(arg);
+    return argv;
+}
+
+static bool start_job(Job& job, int epfd, size_t index) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return false;
+
+    job.started = Clock::now();
+    uint64_t fork_start = record_clock();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Вывод и ошибки задания идут в один канал, чтобы сохранить их порядок
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+
+        vector<char*> exec_args;
+        for (const auto& arg : job.argv) {
+            exec_args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        exec_args.push_back(nullptr);
+
+        execvp(exec_args[0], exec_args.data());
+        fprintf(stderr, "%s: command not found\n", exec_args[0]);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    record_stage(STAGE_SPAWN, record_clock() - fork_start);
+    record_spawn(job.argv[0]);
+    job.pid = pid;
+    job.out_fd = fds[0];
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = index << 1;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, job.out_fd, &ev);
+
+    job.pidfd = open_pidfd(pid);
+    if (job.pidfd >= 0) {
+        ev.data.u64 = (index << 1) | EV_PIDFD;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, job.pidfd, &ev);
+    }
+    return true;
+}
+
+static void drain_output(Job& job, int epfd) {
+    char buf[8192];
+    ssize_t n = read(job.out_fd, buf, sizeof(buf));
+    if (n > 0) {
+        job.output.append(buf, n);
+        return;
+    }
+    if (n < 0 && errno == EINTR) return;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, job.out_fd, nullptr);
+    close(job.out_fd);
+    job.out_fd = -1;
+}
+
+static void try_reap(Job& job, int epfd) {
+    int status = 0;
+    struct rusage usage;
+    if (wait4(job.pid, &status, WNOHANG, &usage) != job.pid) return;
+    timing_child_exited(usage);
+
+    job.reaped = true;
+    job.finished = Clock::now();
+    job.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    record_exit(job.status);
+    if (job.pidfd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, job.pidfd, nullptr);
+        close(job.pidfd);
+        job.pidfd = -1;
+    }
+}
+
+static double seconds(Clock::duration d) {
+    return chrono::duration<double>(d).count();
+}
+
+// Аргументы из stdin читаются прямо из дескриптора 0, а не через cin:
+// в звене конвейера буфер cin - копия родительского, в нем может лежать
+// еще не выполненный ввод шелла, и он попал бы в задания
+static void read_input_lines(vector<string>& inputs) {
+    string pending;
+    char buf[8192];
+    while (true) {
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        pending.append(buf, n);
+
+        size_t start = 0;
+        size_t nl;
+        while ((nl = pending.find('\n', start)) != string::npos) {
+            if (nl > start) inputs.push_back(pending.substr(start, nl - start));
+            start = nl + 1;
+        }
+        pending.erase(0, start);
+    }
+    if (!pending.empty()) inputs.push_back(pending);
+}
+
+// ==================== Встроенная команда ====================
+int process_parallel(const vector<string>& args) {
+    long jobs_limit = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t i = 1;
+
+    if (i < args.size() && args[i].substr(0, 2) == "-j") {
+        string value = args[i].size() > 2 ? args[i].substr(2) : (i + 1 < args.size() ? args[++i] : "");
+        jobs_limit = atol(value.c_str());
+        i++;
+    }
+    if (jobs_limit < 1) jobs_limit = 1;
+
+    vector<string> command;
+    vector<string> inputs;
+    bool from_args = false;
+    for (; i < args.size(); i++) {
+        if (args[i] == ":::") {
+            from_args = true;
+            inputs.assign(args.begin() + i + 1, args.end());
+            break;
+        }
+        command.push_back(args[i]);
+    }
+
+    if (command.empty()) {
+        cout << "Usage: parallel [-j N] command [args...] [::: arg...]\n";
+        return 1;
+    }
+
+    if (!from_args) read_input_lines(inputs);
+
+    vector<Job> jobs(inputs.size());
+    for (size_t j = 0; j < inputs.size(); j++) {
+        jobs[j].argv = build_argv(command, inputs[j]);
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        cerr << "parallel: epoll_create1: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    Clock::time_point wall_start = Clock::now();
+    size_t next = 0;
+    size_t active = 0;
+    size_t done = 0;
+    size_t failed = 0;
+    vector<size_t> in_flight;
+
+    // Вывод задания печатается целиком, когда оно завершилось и закрыло канал
+    auto flush_finished = [&]() {
+        for (size_t k = 0; k < in_flight.size(); ) {
+            Job& job = jobs[in_flight[k]];
+            if (!job.reaped || job.out_fd >= 0) {
+                k++;
+                continue;
+            }
+            cout.write(job.output.data(), job.output.size());
+            job.output.clear();
+            job.output.shrink_to_fit();
+            if (job.status != 0) failed++;
+            if (job.pid > 0) active--;
+            done++;
+            in_flight.erase(in_flight.begin() + k);
+        }
+    };
+
+    while (done < jobs.size()) {
+        // Поддерживаем N заданий в работе
+        while (active < (size_t)jobs_limit && next < jobs.size() && running) {
+            Job& job = jobs[next];
+            if (start_job(job, epfd, next)) {
+                in_flight.push_back(next);
+                active++;
+            } else {
+                job.reaped = true;
+                job.status = 127;
+                job.output = job.argv[0] + ": failed to start\n";
+                in_flight.push_back(next);
+            }
+            next++;
+        }
+        flush_finished();
+
+        // Оставшиеся задания не запускаются после SIGINT/SIGTERM
+        if (in_flight.empty()) break;
+
+        // Если pidfd не поддерживается ядром, завершение проверяем по таймауту
+        bool polling = false;
+        for (size_t idx : in_flight) {
+            if (!jobs[idx].reaped && jobs[idx].pidfd < 0) polling = true;
+        }
+
+        struct epoll_event events[64];
+        uint64_t wait_start = record_clock();
+        int n = epoll_wait(epfd, events, 64, polling ? 10 : -1);
+        record_stage(STAGE_WAIT, record_clock() - wait_start);
+        for (int e = 0; e < n; e++) {
+            Job& job = jobs[events[e].data.u64 >> 1];
+            if (events[e].data.u64 & EV_PIDFD) {
+                try_reap(job, epfd);
+            } else {
+                drain_output(job, epfd);
+            }
+        }
+        if (polling) {
+            for (size_t idx : in_flight) {
+                if (!jobs[idx].reaped && jobs[idx].pidfd < 0) try_reap(jobs[idx], epfd);
+            }
+        }
+
+        flush_finished();
+    }
+    close(epfd);
+
+    double wall = seconds(Clock::now() - wall_start);
+
+    // Итоговый отчет по заданиям в порядке аргументов
+    for (size_t j = 0; j < jobs.size(); j++) {
+        const Job& job = jobs[j];
+        if (job.pid <= 0 && !job.reaped) continue;
+
+        string cmdline;
+        for (const auto& word : job.argv) {
+            if (!cmdline.empty()) cmdline += ' ';
+            cmdline += word;
+        }
+        double took = job.pid > 0 ? seconds(job.finished - job.started) : 0.0;
+        fprintf(stderr, "[%zu] exit %d  %.3fs  %s\n", j + 1, job.status, took, cmdline.c_str());
+    }
+    fprintf(stderr, "parallel: %zu jobs, %zu failed, -j %ld, wall %.3fs\n",
+            done, failed, jobs_limit, wall);
+
+    return failed > 100 ? 101 : (int)failed;
+}
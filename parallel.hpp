@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// parallel [-j N] cmd [args...] [::: arg...]
+// Запускает cmd для каждого аргумента (после ::: или по строкам из stdin),
+// держа не более N процессов одновременно. Возвращает число неудачных заданий
+int process_parallel(const std::vector<std::string>& args);
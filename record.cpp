@@ -0,0 +1,288 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <streambuf>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "record.hpp"
+
+using namespace std;
+
+// ==================== Формат журнала ====================
+// Заголовок: "KUBSHREC" и байт версии. Дальше события подряд:
+//   тип (1 байт), время от начала записи в нс (varint), данные:
+//   INPUT/DISPATCH/SPAWN - длина (varint) и байты строки, EXIT - код (varint).
+// varint - 7 бит на байт, старший бит - есть продолжение, так что
+// типичное событие занимает 5-10 байт плюс строка
+static const char RECORD_MAGIC[8] = {'K', 'U', 'B', 'S', 'H', 'R', 'E', 'C'};
+static const unsigned char RECORD_VERSION = 1;
+
+enum RecordEvent : unsigned char { EV_INPUT = 1, EV_DISPATCH, EV_SPAWN, EV_EXIT };
+
+static void put_varint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += (char)(value | 0x80);
+        value >>= 7;
+    }
+    out += (char)value;
+}
+
+static bool get_varint(const string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char byte = in[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+uint64_t record_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ==================== Запись ====================
+// События копятся в буфере и сбрасываются одним write на каждую введенную
+// строку. Буфер наследуют дочерние процессы, но писать может только
+// процесс, открывший журнал
+static int record_fd = -1;
+static pid_t record_pid = 0;
+static uint64_t record_origin = 0;
+static string record_buf;
+
+static void record_flush() {
+    if (record_fd < 0 || getpid() != record_pid || record_buf.empty()) return;
+
+    const char* data = record_buf.data();
+    size_t left = record_buf.size();
+    while (left > 0) {
+        ssize_t n = write(record_fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+    record_buf.clear();
+}
+
+bool record_open(const string& path) {
+    record_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (record_fd < 0) {
+        cerr << "kubsh: cannot record to " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    record_pid = getpid();
+    record_origin = record_clock();
+    record_buf.assign(RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    record_buf += (char)RECORD_VERSION;
+    record_flush();
+    atexit(record_flush);
+    return true;
+}
+
+static bool recording() {
+    return record_fd >= 0 && getpid() == record_pid;
+}
+
+static void record_event(RecordEvent type, const string& text) {
+    record_buf += (char)type;
+    put_varint(record_buf, record_clock() - record_origin);
+    put_varint(record_buf, text.size());
+    record_buf += text;
+}
+
+void record_input(const string& text) {
+    if (!recording()) return;
+    // Предыдущая строка закончена - ее события уходят на диск
+    record_flush();
+    record_event(EV_INPUT, text);
+}
+
+void record_dispatch(const string& name) {
+    if (recording()) record_event(EV_DISPATCH, name);
+}
+
+void record_spawn(const string& command) {
+    if (recording()) record_event(EV_SPAWN, command);
+}
+
+// ==================== Время по этапам ====================
+static bool stages_enabled = false;
+static uint64_t stage_ns[STAGE_COUNT];
+
+// Коды завершения текущей строки при воспроизведении
+static vector<int> replay_exits;
+
+void record_exit(int status) {
+    if (recording()) {
+        record_buf += (char)EV_EXIT;
+        put_varint(record_buf, record_clock() - record_origin);
+        put_varint(record_buf, (uint64_t)status);
+    }
+    if (stages_enabled) replay_exits.push_back(status);
+}
+
+void record_stage(RecordStage stage, uint64_t ns) {
+    if (stages_enabled) stage_ns[stage] += ns;
+}
+
+// Время записи в cout - этап output. Вывод внешних команд
+// идет в дескриптор напрямую и сюда не попадает
+class TimedStreambuf : public streambuf {
+public:
+    explicit TimedStreambuf(streambuf* target) : target(target) {}
+
+protected:
+    int_type overflow(int_type c) override {
+        uint64_t start = record_clock();
+        int_type r = traits_type::eq_int_type(c, traits_type::eof()) ? traits_type::not_eof(c) : target->sputc(traits_type::to_char_type(c));
+        record_stage(STAGE_OUTPUT, record_clock() - start);
+        return r;
+    }
+
+    streamsize xsputn(const char* s, streamsize n) override {
+        uint64_t start = record_clock();
+        streamsize r = target->sputn(s, n);
+        record_stage(STAGE_OUTPUT, record_clock() - start);
+        return r;
+    }
+
+    int sync() override {
+        uint64_t start = record_clock();
+        int r = target->pubsync();
+        record_stage(STAGE_OUTPUT, record_clock() - start);
+        return r;
+    }
+
+private:
+    streambuf* target;
+};
+
+// ==================== Воспроизведение ====================
+// Коды завершения хранятся по строкам ввода и сравниваются без учета
+// порядка: parallel забирает задания в порядке завершения, а не запуска
+struct ReplayInput {
+    uint64_t at;
+    string text;
+    vector<int> exits;
+};
+
+static bool load_log(const string& path, vector<ReplayInput>& inputs, size_t& spawns) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        cerr << "kubsh: cannot open " << path << "\n";
+        return false;
+    }
+    stringstream ss;
+    ss << file.rdbuf();
+    string data = ss.str();
+
+    if (data.size() < sizeof(RECORD_MAGIC) + 1 || memcmp(data.data(), RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+        (unsigned char)data[sizeof(RECORD_MAGIC)] != RECORD_VERSION) {
+        cerr << "kubsh: " << path << ": not a kubsh session log\n";
+        return false;
+    }
+
+    size_t pos = sizeof(RECORD_MAGIC) + 1;
+    while (pos < data.size()) {
+        unsigned char type = data[pos++];
+        uint64_t at, value;
+        if (!get_varint(data, pos, at) || !get_varint(data, pos, value)) break;
+
+        if (type == EV_EXIT) {
+            if (!inputs.empty()) inputs.back().exits.push_back((int)value);
+            continue;
+        }
+        if (value > data.size() - pos) break;
+        string text = data.substr(pos, value);
+        pos += value;
+
+        if (type == EV_INPUT) inputs.push_back({at, text, {}});
+        else if (type == EV_SPAWN) spawns++;
+    }
+    if (pos < data.size()) {
+        cerr << "kubsh: " << path << ": truncated log, replaying " << inputs.size() << " inputs\n";
+    }
+    return true;
+}
+
+int replay_run(const string& path, double speed, double min_rate, replay_input_runner run) {
+    vector<ReplayInput> inputs;
+    size_t recorded_spawns = 0;
+    if (!load_log(path, inputs, recorded_spawns)) return 1;
+
+    TimedStreambuf timed(cout.rdbuf());
+    streambuf* original = cout.rdbuf(&timed);
+    stages_enabled = true;
+
+    uint64_t start = record_clock();
+    uint64_t total_ns = 0;
+    size_t done = 0;
+    size_t exits = 0;
+    size_t mismatches = 0;   // Строки, у которых набор кодов завершения отличается от записи
+    for (const ReplayInput& input : inputs) {
+        if (speed > 0 && done > 0) {
+            // Сохраняем паузы записи: строка выполняется не раньше своего времени
+            uint64_t due = start + (uint64_t)((input.at - inputs[0].at) / speed);
+            uint64_t now = record_clock();
+            if (due > now) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000ull), (long)((due - now) % 1000000000ull) };
+                nanosleep(&ts, nullptr);
+            }
+        }
+
+        replay_exits.clear();
+        uint64_t line_start = record_clock();
+        bool keep_running = run(input.text);
+        total_ns += record_clock() - line_start;
+        done++;
+
+        vector<int> expected = input.exits;
+        sort(expected.begin(), expected.end());
+        sort(replay_exits.begin(), replay_exits.end());
+        if (expected != replay_exits) mismatches++;
+        exits += replay_exits.size();
+        if (!keep_running) break;
+    }
+    double wall = (record_clock() - start) / 1e9;
+
+    cout.flush();
+    cout.rdbuf(original);
+    stages_enabled = false;
+
+    // dispatch - все, что не попало в остальные этапы: выбор команды,
+    // встроенные команды, раскрытие слов
+    uint64_t accounted = stage_ns[STAGE_PARSE] + stage_ns[STAGE_SPAWN] + stage_ns[STAGE_WAIT] + stage_ns[STAGE_OUTPUT];
+    stage_ns[STAGE_DISPATCH] = total_ns > accounted ? total_ns - accounted : 0;
+
+    double rate = wall > 0 ? done / wall : 0;
+    fprintf(stderr, "replay: %zu inputs, %zu exits (%zu recorded spawns), %zu inputs with exit mismatches\n",
+            done, exits, recorded_spawns, mismatches);
+    fprintf(stderr, "replay: wall %.3fs, %.1f inputs/s\n", wall, rate);
+
+    static const char* const stage_names[STAGE_COUNT] = {"parse", "dispatch", "spawn", "wait", "output"};
+    fprintf(stderr, "%-10s %12s %14s %7s\n", "stage", "total ms", "per input us", "share");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        fprintf(stderr, "%-10s %12.3f %14.2f %6.1f%%\n", stage_names[s], stage_ns[s] / 1e6,
+                done ? stage_ns[s] / 1e3 / done : 0.0, total_ns ? 100.0 * stage_ns[s] / total_ns : 0.0);
+    }
+
+    if (min_rate > 0 && rate < min_rate) {
+        fprintf(stderr, "replay: %.1f inputs/s is below the threshold of %.1f\n", rate, min_rate);
+        return 2;
+    }
+    return 0;
+}
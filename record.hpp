@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Этапы обработки строки, время которых показывает --replay
+enum RecordStage { STAGE_PARSE, STAGE_DISPATCH, STAGE_SPAWN, STAGE_WAIT, STAGE_OUTPUT, STAGE_COUNT };
+
+// Монотонное время в наносекундах
+uint64_t record_clock();
+
+// Учет времени этапа (считается только при --replay)
+void record_stage(RecordStage stage, uint64_t ns);
+
+// kubsh --record FILE: журнал сеанса пишется в FILE
+bool record_open(const std::string& path);
+
+// События журнала. Пишет только сам шелл: копии в дочерних процессах молчат
+void record_input(const std::string& text);
+void record_dispatch(const std::string& name);
+void record_spawn(const std::string& command);
+void record_exit(int status);
+
+// kubsh --replay FILE: выполняет записанный ввод заново и печатает время по этапам.
+// speed 0 - без пауз (--speed max), иначе паузы между строками делятся на speed.
+// min_rate > 0 - код 2, если строк в секунду меньше (для make bench)
+typedef bool (*replay_input_runner)(const std::string& text);
+int replay_run(const std::string& path, double speed, double min_rate, replay_input_runner run);
@@ -0,0 +1,1401 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "script.hpp"
+#include "parallel.hpp"
+#include "timing.hpp"
+#include "glob.hpp"
+#include "record.hpp"
+
+using namespace std;
+
+extern volatile sig_atomic_t running;
+
+// ==================== Синтаксическое дерево ====================
+// Текст разбирается один раз. Слова без подстановок раскрываются прямо
+// при разборе, а узел команды запоминает, чем оказалась команда
+// (функция, встроенная, внешняя с полным путем), поэтому тело цикла
+// на каждой итерации не токенизируется и не ищется в PATH заново
+struct Node;
+
+struct WordPart {
+    enum Kind { LITERAL, VARIABLE, SUBST } kind;
+    bool quoted;
+    string text;                  // Текст литерала или имя переменной
+    shared_ptr<Node> subst;       // $(...)
+};
+
+struct Word {
+    vector<WordPart> parts;
+    bool constant = true;         // Нет подстановок - значение известно заранее
+    bool has_quotes = false;
+    string value;                 // Значение для constant
+    bool glob = false;            // *, ? или [...] вне кавычек - раскрывается по файлам
+    string pattern;               // Шаблон для constant с glob: текст из кавычек экранирован
+    string source;                // Слово как в исходном тексте, с кавычками
+};
+
+enum NodeType { N_LIST, N_AND_OR, N_NOT, N_PIPELINE, N_SIMPLE, N_IF, N_FOR, N_WHILE, N_UNTIL, N_FUNCDEF, N_GROUP };
+
+enum CommandKind { C_UNRESOLVED, C_FUNCTION, C_BUILTIN, C_LEGACY, C_EXTERNAL };
+
+enum AndOrOp { OP_AND, OP_OR };
+
+struct Node {
+    NodeType type;
+    vector<shared_ptr<Node>> children;
+    vector<AndOrOp> ops;                      // N_AND_OR
+
+    // N_SIMPLE
+    vector<pair<string, Word>> assigns;
+    vector<Word> words;
+    bool constant_argv = false;
+    vector<string> argv;                      // Готовые аргументы, если все слова constant
+    string legacy_line;                       // Исходный текст команды для обработчика строки main.cpp
+
+    // N_FOR, N_FUNCDEF
+    string name;
+    vector<Word> items;
+    bool has_in = false;
+
+    // Кэш разрешения команды
+    CommandKind kind = C_UNRESOLVED;
+    string path;
+    shared_ptr<Node> function;
+    unsigned long resolved_gen = 0;
+};
+
+// ==================== Лексический анализ ====================
+enum TokenType { T_WORD, T_NEWLINE, T_SEMI, T_AND, T_OR, T_PIPE, T_LPAREN, T_RPAREN, T_EOF };
+
+struct Token {
+    TokenType type;
+    Word word;
+};
+
+struct ParseState {
+    string error;
+    bool incomplete = false;
+};
+
+static shared_ptr<Node> parse_text(const string& text, ParseState& state);
+
+static bool is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+static bool is_meta(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+           c == '|' || c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+class Lexer {
+public:
+    Lexer(const string& src, ParseState& state) : src(src), state(state) {}
+
+    bool tokenize(vector<Token>& tokens) {
+        while (true) {
+            while (pos < src.size() && (src[pos] == ' ' || src[pos] == '\t')) pos++;
+            if (pos >= src.size()) break;
+
+            char c = src[pos];
+            if (c == '#') {
+                while (pos < src.size() && src[pos] != '\n') pos++;
+                continue;
+            }
+            if (c == '\\' && pos + 1 < src.size() && src[pos + 1] == '\n') {
+                pos += 2;
+                continue;
+            }
+
+            Token tok;
+            if (c == '\n') { tok.type = T_NEWLINE; pos++; }
+            else if (c == ';') { tok.type = T_SEMI; pos++; }
+            else if (c == '(') { tok.type = T_LPAREN; pos++; }
+            else if (c == ')') { tok.type = T_RPAREN; pos++; }
+            else if (src.compare(pos, 2, "&&") == 0) { tok.type = T_AND; pos += 2; }
+            else if (src.compare(pos, 2, "||") == 0) { tok.type = T_OR; pos += 2; }
+            else if (c == '|') { tok.type = T_PIPE; pos++; }
+            else if (c == '&' || c == '<' || c == '>') {
+                state.error = string("unsupported operator '") + c + "'";
+                return false;
+            }
+            else {
+                tok.type = T_WORD;
+                size_t start = pos;
+                if (!lex_word(tok.word)) return false;
+                tok.word.source = src.substr(start, pos - start);
+            }
+            tokens.push_back(move(tok));
+        }
+
+        tokens.push_back({T_EOF, {}});
+        return true;
+    }
+
+private:
+    const string& src;
+    ParseState& state;
+    size_t pos = 0;
+
+    void add_literal(Word& w, string& lit, bool quoted) {
+        if (lit.empty() && !quoted) return;
+        w.parts.push_back({WordPart::LITERAL, quoted, lit, nullptr});
+        lit.clear();
+    }
+
+    bool lex_dollar(Word& w, bool quoted) {
+        pos++;  // '$'
+        if (pos >= src.size()) {
+            w.parts.push_back({WordPart::LITERAL, quoted, "$", nullptr});
+            return true;
+        }
+
+        char c = src[pos];
+        if (c == '{') {
+            size_t end = src.find('}', pos);
+            if (end == string::npos) {
+                state.incomplete = true;
+                return false;
+            }
+            w.parts.push_back({WordPart::VARIABLE, quoted, src.substr(pos + 1, end - pos - 1), nullptr});
+            pos = end + 1;
+        }
+        else if (c == '(') {
+            size_t end = matching_paren(pos);
+            if (end == string::npos) {
+                state.incomplete = true;
+                return false;
+            }
+            ParseState inner;
+            shared_ptr<Node> node = parse_text(src.substr(pos + 1, end - pos - 1), inner);
+            if (!node) {
+                state.error = inner.error;
+                state.incomplete = inner.incomplete;
+                return false;
+            }
+            w.parts.push_back({WordPart::SUBST, quoted, "", node});
+            pos = end + 1;
+        }
+        else if (c == '?' || c == '#' || c == '@' || c == '*' || (c >= '0' && c <= '9')) {
+            w.parts.push_back({WordPart::VARIABLE, quoted, string(1, c), nullptr});
+            pos++;
+        }
+        else if (is_name_start(c)) {
+            size_t start = pos;
+            while (pos < src.size() && is_name_char(src[pos])) pos++;
+            w.parts.push_back({WordPart::VARIABLE, quoted, src.substr(start, pos - start), nullptr});
+        }
+        else {
+            w.parts.push_back({WordPart::LITERAL, quoted, "$", nullptr});
+            return true;
+        }
+        w.constant = false;
+        return true;
+    }
+
+    // Позиция ')' парной к '(' в позиции open, с учетом кавычек и вложенности
+    size_t matching_paren(size_t open) {
+        int depth = 1;
+        for (size_t i = open + 1; i < src.size(); i++) {
+            char c = src[i];
+            if (c == '\\') {
+                i++;
+            } else if (c == '\'') {
+                i = src.find('\'', i + 1);
+                if (i == string::npos) return string::npos;
+            } else if (c == '"') {
+                for (i++; i < src.size() && src[i] != '"'; i++) {
+                    if (src[i] == '\\') i++;
+                }
+                if (i >= src.size()) return string::npos;
+            } else if (c == '(') {
+                depth++;
+            } else if (c == ')' && --depth == 0) {
+                return i;
+            }
+        }
+        return string::npos;
+    }
+
+    bool lex_word(Word& w) {
+        string lit;
+        while (pos < src.size() && !is_meta(src[pos])) {
+            char c = src[pos];
+            if (c == '\\') {
+                if (pos + 1 >= src.size()) {
+                    state.incomplete = true;
+                    return false;
+                }
+                add_literal(w, lit, false);
+                lit = src[pos + 1];
+                add_literal(w, lit, true);
+                w.has_quotes = true;
+                pos += 2;
+            }
+            else if (c == '\'') {
+                size_t end = src.find('\'', pos + 1);
+                if (end == string::npos) {
+                    state.incomplete = true;
+                    return false;
+                }
+                add_literal(w, lit, false);
+                lit = src.substr(pos + 1, end - pos - 1);
+                add_literal(w, lit, true);
+                w.has_quotes = true;
+                pos = end + 1;
+            }
+            else if (c == '"') {
+                add_literal(w, lit, false);
+                w.has_quotes = true;
+                pos++;
+                while (true) {
+                    if (pos >= src.size()) {
+                        state.incomplete = true;
+                        return false;
+                    }
+                    char q = src[pos];
+                    if (q == '"') {
+                        pos++;
+                        break;
+                    }
+                    if (q == '\\' && pos + 1 < src.size() && strchr("$`\"\\\n", src[pos + 1])) {
+                        if (src[pos + 1] != '\n') lit += src[pos + 1];
+                        pos += 2;
+                    } else if (q == '$') {
+                        add_literal(w, lit, true);
+                        if (!lex_dollar(w, true)) return false;
+                    } else {
+                        lit += q;
+                        pos++;
+                    }
+                }
+                add_literal(w, lit, true);
+            }
+            else if (c == '$') {
+                add_literal(w, lit, false);
+                if (!lex_dollar(w, false)) return false;
+            }
+            else {
+                lit += c;
+                pos++;
+            }
+        }
+        add_literal(w, lit, false);
+
+        if (w.constant) {
+            for (const auto& part : w.parts) {
+                w.value += part.text;
+                w.pattern += part.quoted ? glob_escape(part.text) : part.text;
+            }
+            w.glob = glob_has_magic(w.pattern);
+            if (!w.glob) w.pattern.clear();
+        }
+        return true;
+    }
+};
+
+// ==================== Синтаксический анализ ====================
+class Parser {
+public:
+    Parser(vector<Token>& tokens, ParseState& state) : tokens(tokens), state(state) {}
+
+    shared_ptr<Node> parse_program() {
+        shared_ptr<Node> list = parse_list({});
+        if (!list) return nullptr;
+        if (peek().type != T_EOF) return fail("unexpected token");
+        return list;
+    }
+
+private:
+    vector<Token>& tokens;
+    ParseState& state;
+    size_t pos = 0;
+
+    const Token& peek(size_t ahead = 0) const {
+        size_t i = min(pos + ahead, tokens.size() - 1);
+        return tokens[i];
+    }
+
+    shared_ptr<Node> fail(const string& message) {
+        if (peek().type == T_EOF) {
+            state.incomplete = true;
+        }
+        if (state.error.empty()) state.error = message;
+        return nullptr;
+    }
+
+    // Слово без кавычек и подстановок с заданным текстом
+    bool is_keyword(const Token& tok, const char* kw) const {
+        return tok.type == T_WORD && tok.word.constant && !tok.word.has_quotes && tok.word.value == kw;
+    }
+
+    bool at_terminator(const vector<const char*>& terminators) const {
+        for (const char* kw : terminators) {
+            if (is_keyword(peek(), kw)) return true;
+        }
+        return false;
+    }
+
+    void skip_newlines() {
+        while (peek().type == T_NEWLINE) pos++;
+    }
+
+    void skip_separators() {
+        while (peek().type == T_NEWLINE || peek().type == T_SEMI) pos++;
+    }
+
+    bool expect_keyword(const char* kw) {
+        skip_separators();
+        if (!is_keyword(peek(), kw)) {
+            fail(string("expected '") + kw + "'");
+            return false;
+        }
+        pos++;
+        return true;
+    }
+
+    shared_ptr<Node> parse_list(const vector<const char*>& terminators) {
+        auto list = make_shared<Node>();
+        list->type = N_LIST;
+
+        skip_separators();
+        while (peek().type != T_EOF && peek().type != T_RPAREN && !at_terminator(terminators)) {
+            shared_ptr<Node> item = parse_and_or();
+            if (!item) return nullptr;
+            list->children.push_back(item);
+
+            if (peek().type == T_SEMI || peek().type == T_NEWLINE) {
+                skip_separators();
+            } else {
+                break;
+            }
+        }
+        return list;
+    }
+
+    shared_ptr<Node> parse_and_or() {
+        shared_ptr<Node> first = parse_pipeline();
+        if (!first) return nullptr;
+        if (peek().type != T_AND && peek().type != T_OR) return first;
+
+        auto node = make_shared<Node>();
+        node->type = N_AND_OR;
+        node->children.push_back(first);
+        while (peek().type == T_AND || peek().type == T_OR) {
+            node->ops.push_back(peek().type == T_AND ? OP_AND : OP_OR);
+            pos++;
+            skip_newlines();
+            shared_ptr<Node> next = parse_pipeline();
+            if (!next) return nullptr;
+            node->children.push_back(next);
+        }
+        return node;
+    }
+
+    shared_ptr<Node> parse_pipeline() {
+        if (is_keyword(peek(), "!")) {
+            pos++;
+            auto node = make_shared<Node>();
+            node->type = N_NOT;
+            shared_ptr<Node> inner = parse_pipeline();
+            if (!inner) return nullptr;
+            node->children.push_back(inner);
+            return node;
+        }
+
+        shared_ptr<Node> first = parse_command();
+        if (!first || peek().type != T_PIPE) return first;
+
+        auto node = make_shared<Node>();
+        node->type = N_PIPELINE;
+        node->children.push_back(first);
+        while (peek().type == T_PIPE) {
+            pos++;
+            skip_newlines();
+            shared_ptr<Node> next = parse_command();
+            if (!next) return nullptr;
+            node->children.push_back(next);
+        }
+        return node;
+    }
+
+    shared_ptr<Node> parse_command() {
+        const Token& tok = peek();
+        if (is_keyword(tok, "if")) return parse_if();
+        if (is_keyword(tok, "for")) return parse_for();
+        if (is_keyword(tok, "while")) return parse_while(N_WHILE);
+        if (is_keyword(tok, "until")) return parse_while(N_UNTIL);
+        if (is_keyword(tok, "{")) return parse_group();
+        if (is_keyword(tok, "function")) {
+            pos++;
+            return parse_funcdef();
+        }
+        if (tok.type == T_WORD && peek(1).type == T_LPAREN) return parse_funcdef();
+        return parse_simple();
+    }
+
+    shared_ptr<Node> parse_if() {
+        auto node = make_shared<Node>();
+        node->type = N_IF;
+        pos++;  // if
+
+        while (true) {
+            shared_ptr<Node> cond = parse_list({"then"});
+            if (!cond || !expect_keyword("then")) return nullptr;
+            shared_ptr<Node> body = parse_list({"elif", "else", "fi"});
+            if (!body) return nullptr;
+            node->children.push_back(cond);
+            node->children.push_back(body);
+
+            if (is_keyword(peek(), "elif")) {
+                pos++;
+                continue;
+            }
+            if (is_keyword(peek(), "else")) {
+                pos++;
+                shared_ptr<Node> else_body = parse_list({"fi"});
+                if (!else_body) return nullptr;
+                node->children.push_back(else_body);
+            }
+            break;
+        }
+
+        if (!expect_keyword("fi")) return nullptr;
+        return node;
+    }
+
+    shared_ptr<Node> parse_for() {
+        auto node = make_shared<Node>();
+        node->type = N_FOR;
+        pos++;  // for
+
+        const Token& name = peek();
+        if (name.type != T_WORD || !name.word.constant) return fail("expected loop variable");
+        node->name = name.word.value;
+        pos++;
+
+        skip_newlines();
+        if (is_keyword(peek(), "in")) {
+            node->has_in = true;
+            pos++;
+            while (peek().type == T_WORD) {
+                node->items.push_back(peek().word);
+                pos++;
+            }
+        }
+
+        if (!expect_keyword("do")) return nullptr;
+        shared_ptr<Node> body = parse_list({"done"});
+        if (!body || !expect_keyword("done")) return nullptr;
+        node->children.push_back(body);
+        return node;
+    }
+
+    shared_ptr<Node> parse_while(NodeType type) {
+        auto node = make_shared<Node>();
+        node->type = type;
+        pos++;  // while / until
+
+        shared_ptr<Node> cond = parse_list({"do"});
+        if (!cond || !expect_keyword("do")) return nullptr;
+        shared_ptr<Node> body = parse_list({"done"});
+        if (!body || !expect_keyword("done")) return nullptr;
+        node->children.push_back(cond);
+        node->children.push_back(body);
+        return node;
+    }
+
+    shared_ptr<Node> parse_group() {
+        pos++;  // {
+        shared_ptr<Node> body = parse_list({"}"});
+        if (!body || !expect_keyword("}")) return nullptr;
+        auto node = make_shared<Node>();
+        node->type = N_GROUP;
+        node->children.push_back(body);
+        return node;
+    }
+
+    shared_ptr<Node> parse_funcdef() {
+        const Token& name = peek();
+        if (name.type != T_WORD || !name.word.constant) return fail("expected function name");
+
+        auto node = make_shared<Node>();
+        node->type = N_FUNCDEF;
+        node->name = name.word.value;
+        pos++;
+
+        if (peek().type == T_LPAREN) {
+            pos++;
+            if (peek().type != T_RPAREN) return fail("expected ')'");
+            pos++;
+        }
+        skip_newlines();
+        if (!is_keyword(peek(), "{")) return fail("expected '{'");
+
+        shared_ptr<Node> body = parse_group();
+        if (!body) return nullptr;
+        node->children.push_back(body);
+        return node;
+    }
+
+    // NAME=значение в начале простой команды
+    static bool split_assignment(const Word& word, string& name, Word& value) {
+        if (word.parts.empty() || word.parts[0].kind != WordPart::LITERAL || word.parts[0].quoted) {
+            return false;
+        }
+        const string& text = word.parts[0].text;
+        size_t eq = text.find('=');
+        if (eq == string::npos || eq == 0 || !is_name_start(text[0])) return false;
+        for (size_t i = 1; i < eq; i++) {
+            if (!is_name_char(text[i])) return false;
+        }
+
+        name = text.substr(0, eq);
+        value = Word();
+        value.constant = word.constant;
+        value.has_quotes = word.has_quotes;
+        if (eq + 1 < text.size()) {
+            value.parts.push_back({WordPart::LITERAL, false, text.substr(eq + 1), nullptr});
+        }
+        value.parts.insert(value.parts.end(), word.parts.begin() + 1, word.parts.end());
+        if (value.constant) {
+            for (const auto& part : value.parts) value.value += part.text;
+        }
+        return true;
+    }
+
+    shared_ptr<Node> parse_simple() {
+        auto node = make_shared<Node>();
+        node->type = N_SIMPLE;
+
+        while (peek().type == T_WORD && node->words.empty()) {
+            string name;
+            Word value;
+            if (!split_assignment(peek().word, name, value)) break;
+            node->assigns.push_back({name, value});
+            pos++;
+        }
+        while (peek().type == T_WORD) {
+            node->words.push_back(peek().word);
+            pos++;
+        }
+
+        if (node->words.empty() && node->assigns.empty()) return fail("unexpected token");
+
+        node->constant_argv = true;
+        for (const auto& word : node->words) {
+            if (!word.constant || word.glob) {
+                node->constant_argv = false;
+                break;
+            }
+            node->argv.push_back(word.value);
+        }
+        if (!node->constant_argv) node->argv.clear();
+
+        // Встроенные команды main.cpp разбирают строку сами и зависят от
+        // кавычек (debug '...'), поэтому им отдается исходный текст.
+        // С подстановками - склеенные аргументы после раскрытия
+        bool constant_words = true;
+        for (const auto& word : node->words) {
+            if (!word.constant) constant_words = false;
+        }
+        for (size_t i = 0; constant_words && i < node->words.size(); i++) {
+            if (i) node->legacy_line += ' ';
+            node->legacy_line += node->words[i].source;
+        }
+        return node;
+    }
+};
+
+static shared_ptr<Node> parse_text(const string& text, ParseState& state) {
+    vector<Token> tokens;
+    Lexer lexer(text, state);
+    if (!lexer.tokenize(tokens)) return nullptr;
+
+    Parser parser(tokens, state);
+    return parser.parse_program();
+}
+
+// ==================== Состояние интерпретатора ====================
+enum Flow { FLOW_NORMAL, FLOW_BREAK, FLOW_CONTINUE, FLOW_RETURN, FLOW_EXIT };
+
+static map<string, string> variables;
+static map<string, shared_ptr<Node>> functions;
+static vector<vector<string>> call_args;      // Аргументы вызовов функций ($1, $@)
+static int last_status = 0;
+static Flow flow = FLOW_NORMAL;
+static int loop_depth = 0;
+static bool exit_requested = false;
+static script_line_handler line_handler = nullptr;
+
+// Увеличивается при изменении PATH или набора функций - сбрасывает кэш команд
+static unsigned long resolve_generation = 1;
+
+static const char* const script_builtins[] = {
+    "echo", "true", "false", ":", "test", "[", "cd", "export", "unset",
+    "break", "continue", "return", "exit", "source", ".", "parallel", nullptr
+};
+
+// Встроенные команды main.cpp, которые выполняются через обработчик строки
+static const char* const legacy_builtins[] = {
+    "history", "\\q", "\\l", "\\e", "debug", "mkdir", "rmdir", "time", nullptr
+};
+
+static bool in_list(const char* const list[], const string& name) {
+    for (int i = 0; list[i]; i++) {
+        if (name == list[i]) return true;
+    }
+    return false;
+}
+
+static string get_variable(const string& name) {
+    if (name == "?") return to_string(last_status);
+
+    if (!call_args.empty()) {
+        const vector<string>& args = call_args.back();
+        if (name == "#") return to_string(args.size());
+        if (name == "@" || name == "*") {
+            string joined;
+            for (size_t i = 0; i < args.size(); i++) {
+                if (i) joined += ' ';
+                joined += args[i];
+            }
+            return joined;
+        }
+        if (name.size() == 1 && name[0] >= '1' && name[0] <= '9') {
+            size_t idx = name[0] - '1';
+            return idx < args.size() ? args[idx] : "";
+        }
+    }
+
+    auto it = variables.find(name);
+    if (it != variables.end()) return it->second;
+
+    const char* env = getenv(name.c_str());
+    return env ? env : "";
+}
+
+static void set_variable(const string& name, const string& value) {
+    variables[name] = value;
+    // Переменные окружения остаются переменными окружения
+    if (getenv(name.c_str())) setenv(name.c_str(), value.c_str(), 1);
+    if (name == "PATH") resolve_generation++;
+}
+
+static int execute(const Node* node);
+
+// Выполнение $(...) в дочернем процессе с выводом в канал
+static string capture_output(const Node* node) {
+    int fds[2];
+    if (pipe(fds) != 0) return "";
+
+    uint64_t fork_start = record_clock();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        int status = execute(node);
+        cout.flush();
+        fflush(stdout);
+        _exit(status);
+    }
+
+    close(fds[1]);
+    record_stage(STAGE_SPAWN, record_clock() - fork_start);
+    if (pid > 0) record_spawn("$(...)");
+
+    uint64_t wait_start = record_clock();
+    string result;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) result.append(buf, n);
+    }
+    close(fds[0]);
+
+    if (pid > 0) {
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) == pid) timing_child_exited(usage);
+        last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        record_exit(last_status);
+    }
+    record_stage(STAGE_WAIT, record_clock() - wait_start);
+
+    while (!result.empty() && result.back() == '\n') result.pop_back();
+    return result;
+}
+
+// Раскрытие слова в поля: подстановки без кавычек делятся по пробелам,
+// затем поля с *, ? или [...] вне кавычек раскрываются по файлам
+// (если cache передан; в присваиваниях шаблоны не раскрываются)
+static void expand_word(const Word& word, vector<string>& out, GlobCache* cache = nullptr) {
+    if (word.constant) {
+        if (!cache || !word.glob || !glob_expand(word.pattern, *cache, out)) {
+            out.push_back(word.value);
+        }
+        return;
+    }
+
+    string current;
+    string pattern;               // То же поле, но с экранированным текстом из кавычек
+    bool has_field = false;
+
+    auto push_field = [&]() {
+        if (!cache || !glob_has_magic(pattern) || !glob_expand(pattern, *cache, out)) {
+            out.push_back(current);
+        }
+        current.clear();
+        pattern.clear();
+        has_field = false;
+    };
+
+    auto append_split = [&](const string& value) {
+        size_t i = 0;
+        while (i < value.size()) {
+            if (isspace((unsigned char)value[i])) {
+                if (has_field) push_field();
+                while (i < value.size() && isspace((unsigned char)value[i])) i++;
+                continue;
+            }
+            current += value[i];
+            pattern += value[i++];
+            has_field = true;
+        }
+    };
+
+    for (const auto& part : word.parts) {
+        if (part.kind == WordPart::VARIABLE && part.quoted && part.text == "@" && !call_args.empty()) {
+            // "$@" - каждый аргумент отдельным полем
+            const vector<string>& args = call_args.back();
+            for (size_t i = 0; i < args.size(); i++) {
+                if (i > 0) push_field();
+                current += args[i];
+                pattern += glob_escape(args[i]);
+                has_field = true;
+            }
+            continue;
+        }
+
+        string value;
+        if (part.kind == WordPart::LITERAL) {
+            current += part.text;
+            pattern += part.quoted ? glob_escape(part.text) : part.text;
+            has_field = true;
+            continue;
+        }
+        value = part.kind == WordPart::VARIABLE ? get_variable(part.text) : capture_output(part.subst.get());
+
+        if (part.quoted) {
+            current += value;
+            pattern += glob_escape(value);
+            has_field = true;
+        } else {
+            append_split(value);
+        }
+    }
+
+    if (has_field) push_field();
+}
+
+static string expand_single(const Word& word) {
+    if (word.constant) return word.value;
+    vector<string> fields;
+    expand_word(word, fields);
+    string joined;
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (i) joined += ' ';
+        joined += fields[i];
+    }
+    return joined;
+}
+
+static string lookup_in_path(const string& cmd) {
+    struct stat st;
+    if (cmd.find('/') != string::npos) {
+        return stat(cmd.c_str(), &st) == 0 ? cmd : "";
+    }
+
+    const char* path_env = getenv("PATH");
+    if (!path_env) return "";
+
+    stringstream ss(path_env);
+    string dir;
+    while (getline(ss, dir, ':')) {
+        if (dir.empty()) continue;
+        string full_path = dir + "/" + cmd;
+        if (stat(full_path.c_str(), &st) == 0) return full_path;
+    }
+    return "";
+}
+
+// Разрешение команды с кэшем в узле: пока не изменились PATH и функции,
+// повторное выполнение узла не делает ни поиска, ни сравнений строк
+static void resolve_command(Node* node, const string& name) {
+    if (node->words[0].constant && node->kind != C_UNRESOLVED && node->resolved_gen == resolve_generation) {
+        return;
+    }
+
+    node->function.reset();
+    node->path.clear();
+
+    auto fn = functions.find(name);
+    if (fn != functions.end()) {
+        node->kind = C_FUNCTION;
+        node->function = fn->second;
+    } else if (in_list(script_builtins, name)) {
+        node->kind = C_BUILTIN;
+    } else if (in_list(legacy_builtins, name)) {
+        node->kind = C_LEGACY;
+    } else {
+        node->kind = C_EXTERNAL;
+        node->path = lookup_in_path(name);
+    }
+    node->resolved_gen = node->path.empty() && node->kind == C_EXTERNAL ? 0 : resolve_generation;
+}
+
+// ==================== Встроенные команды сценариев ====================
+static int builtin_test(vector<string> args) {
+    if (!args.empty() && args[0] == "[") {
+        if (args.size() < 2 || args.back() != "]") {
+            cerr << "[: missing ']'\n";
+            return 2;
+        }
+        args.pop_back();
+    }
+    args.erase(args.begin());
+
+    bool negate = false;
+    if (!args.empty() && args[0] == "!") {
+        negate = true;
+        args.erase(args.begin());
+    }
+
+    bool result = false;
+    struct stat st;
+    if (args.empty()) {
+        result = false;
+    } else if (args.size() == 1) {
+        result = !args[0].empty();
+    } else if (args.size() == 2) {
+        const string& op = args[0];
+        const string& arg = args[1];
+        if (op == "-z") result = arg.empty();
+        else if (op == "-n") result = !arg.empty();
+        else if (op == "-e") result = stat(arg.c_str(), &st) == 0;
+        else if (op == "-f") result = stat(arg.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+        else if (op == "-d") result = stat(arg.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        else if (op == "-x") result = access(arg.c_str(), X_OK) == 0;
+        else {
+            cerr << "test: unknown operator " << op << "\n";
+            return 2;
+        }
+    } else if (args.size() == 3) {
+        const string& a = args[0];
+        const string& op = args[1];
+        const string& b = args[2];
+        if (op == "=" || op == "==") result = a == b;
+        else if (op == "!=") result = a != b;
+        else {
+            char* end_a;
+            char* end_b;
+            long x = strtol(a.c_str(), &end_a, 10);
+            long y = strtol(b.c_str(), &end_b, 10);
+            if (*end_a || *end_b || a.empty() || b.empty()) {
+                cerr << "test: integer expression expected\n";
+                return 2;
+            }
+            if (op == "-eq") result = x == y;
+            else if (op == "-ne") result = x != y;
+            else if (op == "-lt") result = x < y;
+            else if (op == "-le") result = x <= y;
+            else if (op == "-gt") result = x > y;
+            else if (op == "-ge") result = x >= y;
+            else {
+                cerr << "test: unknown operator " << op << "\n";
+                return 2;
+            }
+        }
+    } else {
+        cerr << "test: too many arguments\n";
+        return 2;
+    }
+
+    return (result != negate) ? 0 : 1;
+}
+
+static int run_builtin(const vector<string>& args) {
+    const string& cmd = args[0];
+
+    if (cmd == "echo") {
+        size_t first = 1;
+        bool newline = true;
+        if (args.size() > 1 && args[1] == "-n") {
+            newline = false;
+            first = 2;
+        }
+        string out;
+        for (size_t i = first; i < args.size(); i++) {
+            if (i > first) out += ' ';
+            out += args[i];
+        }
+        if (newline) out += '\n';
+        cout << out;
+        return 0;
+    }
+    if (cmd == "true" || cmd == ":") return 0;
+    if (cmd == "false") return 1;
+    if (cmd == "test" || cmd == "[") return builtin_test(args);
+    if (cmd == "cd") {
+        string dir = args.size() > 1 ? args[1] : get_variable("HOME");
+        if (chdir(dir.c_str()) != 0) {
+            cerr << "cd: " << dir << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (cmd == "export" || cmd == "unset") {
+        for (size_t i = 1; i < args.size(); i++) {
+            string name = args[i];
+            size_t eq = name.find('=');
+            if (cmd == "unset") {
+                variables.erase(name);
+                unsetenv(name.c_str());
+                continue;
+            }
+            string value = eq == string::npos ? get_variable(name) : name.substr(eq + 1);
+            if (eq != string::npos) name = name.substr(0, eq);
+            variables[name] = value;
+            setenv(name.c_str(), value.c_str(), 1);
+            if (name == "PATH") resolve_generation++;
+        }
+        return 0;
+    }
+    if (cmd == "break" || cmd == "continue") {
+        if (loop_depth == 0) {
+            cerr << cmd << ": only meaningful in a loop\n";
+            return 1;
+        }
+        flow = cmd == "break" ? FLOW_BREAK : FLOW_CONTINUE;
+        return 0;
+    }
+    if (cmd == "return") {
+        flow = FLOW_RETURN;
+        return args.size() > 1 ? atoi(args[1].c_str()) : last_status;
+    }
+    if (cmd == "exit") {
+        flow = FLOW_EXIT;
+        exit_requested = true;
+        return args.size() > 1 ? atoi(args[1].c_str()) : last_status;
+    }
+    if (cmd == "source" || cmd == ".") {
+        if (args.size() < 2) {
+            cerr << cmd << ": filename argument required\n";
+            return 2;
+        }
+        return script_source(args[1]);
+    }
+    if (cmd == "parallel") return process_parallel(args);
+    return 1;
+}
+
+static int spawn(const string& path, const vector<string>& args,
+                 const vector<pair<string, string>>& env) {
+    uint64_t fork_start = record_clock();
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (const auto& kv : env) {
+            setenv(kv.first.c_str(), kv.second.c_str(), 1);
+        }
+        vector<char*> exec_args;
+        for (const auto& arg : args) {
+            exec_args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        exec_args.push_back(nullptr);
+
+        execv(path.c_str(), exec_args.data());
+        _exit(127);
+    }
+    if (pid < 0) {
+        cerr << "Failed to create process\n";
+        return 1;
+    }
+    record_stage(STAGE_SPAWN, record_clock() - fork_start);
+    record_spawn(args[0]);
+
+    int status = 0;
+    struct rusage usage;
+    uint64_t wait_start = record_clock();
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) return 1;
+    }
+    record_stage(STAGE_WAIT, record_clock() - wait_start);
+    timing_child_exited(usage);
+
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    record_exit(code);
+    return code;
+}
+
+// ==================== Выполнение ====================
+static int execute_pipeline(const Node* node) {
+    size_t n = node->children.size();
+    vector<pid_t> pids;
+    int prev = -1;
+
+    // Каждое звено выполняется в своем дочернем процессе,
+    // встроенные команды и функции - тоже
+    for (size_t i = 0; i < n; i++) {
+        int fds[2] = {-1, -1};
+        if (i + 1 < n && pipe(fds) != 0) {
+            cerr << "Failed to create pipe\n";
+            break;
+        }
+
+        uint64_t fork_start = record_clock();
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (prev >= 0) {
+                dup2(prev, STDIN_FILENO);
+                close(prev);
+            }
+            if (fds[1] >= 0) {
+                dup2(fds[1], STDOUT_FILENO);
+                close(fds[0]);
+                close(fds[1]);
+            }
+            int status = execute(node->children[i].get());
+            cout.flush();
+            fflush(stdout);
+            _exit(status);
+        }
+
+        record_stage(STAGE_SPAWN, record_clock() - fork_start);
+        if (prev >= 0) close(prev);
+        if (fds[1] >= 0) close(fds[1]);
+        prev = fds[0];
+        if (pid > 0) {
+            pids.push_back(pid);
+            record_spawn("|");
+        }
+    }
+    if (prev >= 0) close(prev);
+
+    int status = 0;
+    uint64_t wait_start = record_clock();
+    for (pid_t pid : pids) {
+        int st = 0;
+        struct rusage usage;
+        while (wait4(pid, &st, 0, &usage) < 0 && errno == EINTR) {}
+        timing_child_exited(usage);
+        status = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+        record_exit(status);
+    }
+    record_stage(STAGE_WAIT, record_clock() - wait_start);
+    return status;
+}
+
+static int execute_simple(Node* node) {
+    vector<string> expanded;
+    const vector<string>* args = &node->argv;
+    if (!node->constant_argv) {
+        GlobCache cache;
+        for (const auto& word : node->words) {
+            expand_word(word, expanded, &cache);
+        }
+        args = &expanded;
+    }
+
+    if (args->empty()) {
+        for (const auto& assign : node->assigns) {
+            set_variable(assign.first, expand_single(assign.second));
+        }
+        return node->words.empty() ? 0 : last_status;
+    }
+
+    const string& name = (*args)[0];
+    resolve_command(node, name);
+
+    switch (node->kind) {
+    case C_FUNCTION: {
+        record_dispatch(name);
+        call_args.push_back(vector<string>(args->begin() + 1, args->end()));
+        int saved_depth = loop_depth;
+        loop_depth = 0;
+        int status = execute(node->function.get());
+        loop_depth = saved_depth;
+        call_args.pop_back();
+        if (flow == FLOW_RETURN) flow = FLOW_NORMAL;
+        return status;
+    }
+    case C_BUILTIN:
+        record_dispatch(name);
+        return run_builtin(*args);
+    case C_LEGACY: {
+        string line = node->legacy_line;
+        if (line.empty()) {
+            for (size_t i = 0; i < args->size(); i++) {
+                if (i) line += ' ';
+                line += (*args)[i];
+            }
+        }
+        if (!line_handler) return 0;
+
+        bool keep_running = true;
+        int status = line_handler(line, keep_running);
+        if (!keep_running) {
+            flow = FLOW_EXIT;
+            exit_requested = true;
+        }
+        return status;
+    }
+    default:
+        break;
+    }
+
+    if (node->path.empty()) {
+        cout << name << ": command not found" << endl;
+        return 127;
+    }
+
+    vector<pair<string, string>> env;
+    for (const auto& assign : node->assigns) {
+        env.push_back({assign.first, expand_single(assign.second)});
+    }
+    return spawn(node->path, *args, env);
+}
+
+static int execute_loop_body(const Node* body, bool& stop) {
+    int status = execute(body);
+    stop = false;
+    if (flow == FLOW_BREAK) {
+        flow = FLOW_NORMAL;
+        stop = true;
+    } else if (flow == FLOW_CONTINUE) {
+        flow = FLOW_NORMAL;
+    } else if (flow != FLOW_NORMAL || !running) {
+        stop = true;
+    }
+    return status;
+}
+
+static int execute(const Node* node) {
+    int status = 0;
+
+    switch (node->type) {
+    case N_LIST:
+    case N_GROUP:
+        for (const auto& child : node->children) {
+            status = execute(child.get());
+            if (flow != FLOW_NORMAL || !running) break;
+        }
+        break;
+
+    case N_AND_OR:
+        status = execute(node->children[0].get());
+        for (size_t i = 1; i < node->children.size() && flow == FLOW_NORMAL; i++) {
+            bool run_next = node->ops[i - 1] == OP_AND ? status == 0 : status != 0;
+            if (run_next) status = execute(node->children[i].get());
+        }
+        break;
+
+    case N_NOT:
+        status = execute(node->children[0].get()) == 0 ? 1 : 0;
+        break;
+
+    case N_PIPELINE:
+        status = execute_pipeline(node);
+        break;
+
+    case N_SIMPLE:
+        status = execute_simple(const_cast<Node*>(node));
+        break;
+
+    case N_IF: {
+        size_t n = node->children.size();
+        size_t i = 0;
+        bool taken = false;
+        for (; i + 1 < n; i += 2) {
+            int cond = execute(node->children[i].get());
+            if (flow != FLOW_NORMAL) return cond;
+            if (cond == 0) {
+                status = execute(node->children[i + 1].get());
+                taken = true;
+                break;
+            }
+        }
+        if (!taken && i < n) status = execute(node->children[i].get());
+        break;
+    }
+
+    case N_FOR: {
+        vector<string> items;
+        if (node->has_in) {
+            GlobCache cache;
+            for (const auto& word : node->items) expand_word(word, items, &cache);
+        } else if (!call_args.empty()) {
+            items = call_args.back();
+        }
+
+        loop_depth++;
+        for (const auto& item : items) {
+            set_variable(node->name, item);
+            bool stop;
+            status = execute_loop_body(node->children[0].get(), stop);
+            if (stop) break;
+        }
+        loop_depth--;
+        break;
+    }
+
+    case N_WHILE:
+    case N_UNTIL:
+        loop_depth++;
+        while (running) {
+            int cond = execute(node->children[0].get());
+            if (flow != FLOW_NORMAL) break;
+            if ((cond == 0) != (node->type == N_WHILE)) break;
+            bool stop;
+            status = execute_loop_body(node->children[1].get(), stop);
+            if (stop) break;
+        }
+        loop_depth--;
+        break;
+
+    case N_FUNCDEF:
+        functions[node->name] = node->children[0];
+        resolve_generation++;
+        break;
+    }
+
+    last_status = status;
+    return status;
+}
+
+// ==================== Внешний интерфейс ====================
+void script_set_line_handler(script_line_handler handler) {
+    line_handler = handler;
+}
+
+// Есть ли в строке то, что старый разбор по пробелам выполнил бы неверно:
+// |, &&, ||, ; вне кавычек или подстановка $ (кроме одинарных кавычек)
+static bool has_script_syntax(const string& line) {
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') quote = 0;
+            continue;
+        }
+        if (c == '\\') {
+            i++;
+            continue;
+        }
+        if (c == '$') return true;
+        if (quote == '"') {
+            if (c == '"') quote = 0;
+            continue;
+        }
+        if (c == '\'' || c == '"') quote = c;
+        else if (c == '|' || c == ';') return true;
+        else if (c == '&' && i + 1 < line.size() && line[i + 1] == '&') return true;
+    }
+    return false;
+}
+
+bool script_wants_line(const string& line) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == string::npos) return false;
+
+    size_t end = start;
+    while (end < line.size() && !is_meta(line[end])) end++;
+    string first = line.substr(start, end - start);
+
+    // Конвейеры, списки и переменные старый разбор не понимает. echo, debug
+    // и \e остаются на старом пути: им важны кавычки в исходном виде
+    static const char* const quoted_builtins[] = { "echo", "debug", "\\e", nullptr };
+    if (!in_list(quoted_builtins, first) && has_script_syntax(line)) return true;
+
+    // cd и exit меняют состояние самого шелла, поэтому тоже выполняются здесь
+    static const char* const keywords[] = {
+        "if", "for", "while", "until", "function", "{", "!", "source", ".", "export", "unset",
+        "cd", "exit", nullptr
+    };
+    if (in_list(keywords, first)) return true;
+    if (functions.count(first)) return true;
+
+    // NAME=... или NAME() / NAME ()
+    if (first.empty() || !is_name_start(first[0])) return false;
+    size_t i = 1;
+    while (i < first.size() && is_name_char(first[i])) i++;
+    if (i < first.size() && first[i] == '=') return true;
+    size_t next = line.find_first_not_of(" \t", end);
+    return i == first.size() && next != string::npos && line[next] == '(';
+}
+
+bool script_incomplete(const string& text) {
+    ParseState state;
+    parse_text(text, state);
+    return state.incomplete;
+}
+
+int script_run(const string& text) {
+    ParseState state;
+    uint64_t parse_start = record_clock();
+    shared_ptr<Node> program = parse_text(text, state);
+    record_stage(STAGE_PARSE, record_clock() - parse_start);
+    if (!program) {
+        cerr << "kubsh: syntax error: " << state.error << "\n";
+        last_status = 2;
+        return last_status;
+    }
+
+    flow = FLOW_NORMAL;
+    int status = execute(program.get());
+    if (flow != FLOW_EXIT) flow = FLOW_NORMAL;
+    return status;
+}
+
+int script_source(const string& path) {
+    ifstream file(path);
+    if (!file) {
+        cerr << "source: " << path << ": No such file or directory\n";
+        return 1;
+    }
+    stringstream buffer;
+    buffer << file.rdbuf();
+
+    ParseState state;
+    shared_ptr<Node> program = parse_text(buffer.str(), state);
+    if (!program) {
+        cerr << path << ": syntax error: " << state.error << "\n";
+        return 2;
+    }
+    int status = execute(program.get());
+    if (flow == FLOW_RETURN) flow = FLOW_NORMAL;
+    return status;
+}
+
+bool script_exit_requested() {
+    return exit_requested;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// Обработчик обычной строки шелла (встроенные команды из main.cpp).
+// Возвращает код завершения, keep_running = false - шелл нужно завершить
+typedef int (*script_line_handler)(const std::string& line, bool& keep_running);
+void script_set_line_handler(script_line_handler handler);
+
+// Строка начинается с конструкции языка сценариев: if/for/while/until,
+// определение функции, присваивание, source, export или вызов функции
+bool script_wants_line(const std::string& line);
+
+// Текст еще не закончен (нет fi/done/}, незакрытая кавычка) - нужно дочитать строки
+bool script_incomplete(const std::string& text);
+
+// Разбор текста один раз и выполнение, возвращает код завершения
+int script_run(const std::string& text);
+
+// source FILE
+int script_source(const std::string& path);
+
+// Сценарий выполнил exit или \q
+bool script_exit_requested();
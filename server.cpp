@@ -0,0 +1,288 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "server.hpp"
+
+using namespace std;
+
+extern volatile sig_atomic_t running;
+
+// Без XDG_RUNTIME_DIR сокет лежит в личном каталоге /tmp/kubsh-UID с правами 0700.
+// Прямо в /tmp путь мог бы заранее занять другой пользователь и получать
+// команды клиентов, поэтому каталог проверяется: наш, не ссылка, без доступа другим
+string server_default_socket() {
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) return string(runtime) + "/kubsh.sock";
+
+    string dir = "/tmp/kubsh-" + to_string(getuid());
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        cerr << "kubsh: cannot create " << dir << ": " << strerror(errno) << "\n";
+        return "";
+    }
+
+    struct stat st;
+    if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0) {
+        cerr << "kubsh: " << dir << " is not a private directory owned by this user\n";
+        return "";
+    }
+    return dir + "/kubsh.sock";
+}
+
+static bool make_address(const string& path, struct sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        cerr << "kubsh: socket path too long: " << path << "\n";
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// ==================== Передача дескрипторов ====================
+static bool send_fd(int channel, int fd) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    while ((n = sendmsg(channel, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    return n == 1;
+}
+
+// -1 - ошибка или канал закрыт
+static int recv_fd(int channel) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+    if (n <= 0) return -1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// ==================== Процесс-помощник ====================
+// Отделяется до запуска FUSE и любых других потоков, пока процесс маленький.
+// Демон только принимает соединения и передает сокет клиента помощнику, а
+// fork сеанса (и всех команд сеанса) идет от помощника: это стоит одинаково,
+// сколько бы памяти и потоков ни накопил демон, и не копирует его потоки
+static void helper_loop(int channel, server_session_fn session) {
+    while (true) {
+        struct pollfd pfd = { channel, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 1000);
+
+        // Завершившиеся сеансы
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {}
+
+        if (ready < 0 && errno != EINTR) break;
+        if (ready <= 0) continue;
+
+        int client = recv_fd(channel);
+        if (client < 0) break;   // Демон закрыл канал
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(channel);
+            dup2(client, STDIN_FILENO);
+            dup2(client, STDOUT_FILENO);
+            dup2(client, STDERR_FILENO);
+            close(client);
+
+            session();
+            cout.flush();
+            exit(0);
+        }
+        close(client);
+    }
+
+    // Сеансы, которые еще работают, продолжают без помощника
+    _exit(0);
+}
+
+// ==================== Сервер ====================
+// Другая сторона сокета - тот же пользователь или root. Проверяют обе стороны:
+// сервер - потому что сеанс выполняет команды с его правами, клиент - чтобы
+// не отдать свои команды чужому процессу, занявшему путь сокета
+static bool peer_allowed(int fd, uid_t* peer_uid = nullptr) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+    if (peer_uid) *peer_uid = cred.uid;
+    return cred.uid == 0 || cred.uid == getuid();
+}
+
+int server_run(const string& path, void (*init)(), server_session_fn session) {
+    struct sockaddr_un addr;
+    if (!make_address(path, addr)) return 1;
+
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, channel) != 0) {
+        cerr << "kubsh: socketpair: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    pid_t helper = fork();
+    if (helper < 0) {
+        cerr << "kubsh: fork: " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (helper == 0) {
+        close(channel[0]);
+        helper_loop(channel[1], session);
+    }
+    close(channel[1]);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        cerr << "kubsh: socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // Старый сокет остается после аварийного завершения; живой сервер не трогаем
+    if (connect(listener, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        uid_t owner = 0;
+        if (peer_allowed(listener, &owner)) {
+            cerr << "kubsh: server already running on " << path << "\n";
+        } else {
+            cerr << "kubsh: " << path << " is held by a process of uid " << owner << "\n";
+        }
+        return 1;
+    }
+    unlink(path.c_str());
+
+    mode_t old_mask = umask(077);
+    int bound = ::bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound != 0 || listen(listener, SOMAXCONN) != 0) {
+        cerr << "kubsh: cannot listen on " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    // VFS монтируется один раз на все сеансы
+    if (init) init();
+    cout << "kubsh: serving on " << path << endl;
+
+    while (running) {
+        struct pollfd pfd = { listener, POLLIN, 0 };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        if (!peer_allowed(client) || !send_fd(channel[0], client)) {
+            const char* msg = "kubsh: session refused\n";
+            write(client, msg, strlen(msg));
+        }
+        close(client);
+    }
+
+    close(listener);
+    unlink(path.c_str());
+    close(channel[0]);
+    waitpid(helper, nullptr, 0);
+    return 0;
+}
+
+// ==================== Клиент ====================
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+int client_connect(const string& path) {
+    struct sockaddr_un addr;
+    if (!make_address(path, addr)) return 1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        cerr << "kubsh: cannot connect to " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    uid_t owner = 0;
+    if (!peer_allowed(fd, &owner)) {
+        cerr << "kubsh: " << path << " is served by uid " << owner << ", not connecting\n";
+        close(fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char buf[65536];
+    bool input_open = true;
+    while (true) {
+        struct pollfd pfds[2] = {
+            { fd, POLLIN, 0 },
+            { input_open ? STDIN_FILENO : -1, POLLIN, 0 },
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0 || !write_all(STDOUT_FILENO, buf, n)) break;   // Сеанс завершился
+        }
+
+        if (input_open && (pfds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0 || !write_all(fd, buf, n)) {
+                // Конец ввода: сеанс дочитает команды и завершится сам
+                input_open = false;
+                shutdown(fd, SHUT_WR);
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
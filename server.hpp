@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+// Путь к сокету по умолчанию: $XDG_RUNTIME_DIR/kubsh.sock или
+// /tmp/kubsh-UID/kubsh.sock (каталог создается с правами 0700).
+// Пустая строка - каталог небезопасен, сообщение уже выведено
+std::string server_default_socket();
+
+// Сеанс шелла на stdin/stdout/stderr, уже перенаправленных в сокет клиента
+typedef void (*server_session_fn)();
+
+// kubsh --server [SOCKET]. Сначала отделяет маленький процесс-помощник,
+// который порождает сеансы, затем вызывает init (монтирование VFS и т.п.)
+// и принимает клиентов до SIGINT/SIGTERM
+int server_run(const std::string& path, void (*init)(), server_session_fn session);
+
+// kubsh --connect [SOCKET]: stdin - в сеанс, вывод сеанса - в stdout
+int client_connect(const std::string& path);
@@ -0,0 +1,218 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/perf_event.h>
+
+#include "timing.hpp"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// ==================== Учет дочерних процессов ====================
+// Замеры могут быть вложены (time внутри сессионного журнала),
+// поэтому rusage завершившегося процесса добавляется во все активные
+static vector<CommandTiming*> active_timings;
+
+static double tv_seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void timing_child_exited(const struct rusage& usage) {
+    for (CommandTiming* t : active_timings) {
+        t->user += tv_seconds(usage.ru_utime);
+        t->sys += tv_seconds(usage.ru_stime);
+        t->maxrss_kb = max(t->maxrss_kb, usage.ru_maxrss);
+        t->nvcsw += usage.ru_nvcsw;
+        t->nivcsw += usage.ru_nivcsw;
+    }
+}
+
+// ==================== Аппаратные счетчики ====================
+// Счетчики открываются на сам шелл с inherit: они считают и встроенные
+// команды, и все процессы, порожденные после открытия. Значения
+// завершившихся потомков ядро добавляет к счетчику родителя
+static const uint64_t perf_configs[3] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static int perf_open(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void perf_close(CommandTiming& t) {
+    for (int& fd : t.perf_fds) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+}
+
+void timing_start(CommandTiming& t, bool hw) {
+    t = CommandTiming();
+    t.hw = hw;
+
+    if (hw) {
+        for (int i = 0; i < 3; i++) {
+            t.perf_fds[i] = perf_open(perf_configs[i]);
+            if (t.perf_fds[i] < 0) {
+                perf_close(t);
+                break;
+            }
+        }
+        for (int fd : t.perf_fds) {
+            if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    active_timings.push_back(&t);
+    getrusage(RUSAGE_THREAD, &t.self_start);
+    t.started = Clock::now();
+}
+
+void timing_stop(CommandTiming& t) {
+    t.wall = chrono::duration<double>(Clock::now() - t.started).count();
+
+    struct rusage self_end;
+    getrusage(RUSAGE_THREAD, &self_end);
+    t.user += tv_seconds(self_end.ru_utime) - tv_seconds(t.self_start.ru_utime);
+    t.sys += tv_seconds(self_end.ru_stime) - tv_seconds(t.self_start.ru_stime);
+    t.nvcsw += self_end.ru_nvcsw - t.self_start.ru_nvcsw;
+    t.nivcsw += self_end.ru_nivcsw - t.self_start.ru_nivcsw;
+    if (t.maxrss_kb == 0) t.maxrss_kb = self_end.ru_maxrss;
+
+    auto it = find(active_timings.begin(), active_timings.end(), &t);
+    if (it != active_timings.end()) active_timings.erase(it);
+
+    if (t.perf_fds[0] >= 0) {
+        uint64_t values[3] = {0, 0, 0};
+        bool ok = true;
+        for (int i = 0; i < 3; i++) {
+            ioctl(t.perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            ok = ok && read(t.perf_fds[i], &values[i], sizeof(values[i])) == sizeof(values[i]);
+        }
+        if (ok) {
+            t.hw_valid = true;
+            t.cycles = values[0];
+            t.instructions = values[1];
+            t.cache_misses = values[2];
+        }
+    }
+    perf_close(t);
+}
+
+static void print_report(const CommandTiming& t) {
+    fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs  maxrss %ldKB  ctxsw %ld vol / %ld invol\n",
+            t.wall, t.user, t.sys, t.maxrss_kb, t.nvcsw, t.nivcsw);
+    if (!t.hw) return;
+
+    if (t.hw_valid) {
+        double ipc = t.cycles ? (double)t.instructions / t.cycles : 0.0;
+        fprintf(stderr, "cycles %llu  instructions %llu  ipc %.2f  cache-misses %llu\n",
+                (unsigned long long)t.cycles, (unsigned long long)t.instructions, ipc,
+                (unsigned long long)t.cache_misses);
+    } else {
+        fprintf(stderr, "time: hardware counters unavailable\n");
+    }
+}
+
+// ==================== Журнал сессии ====================
+static ofstream session_log;
+static bool session_hw = false;
+
+bool timing_session_enabled() {
+    return session_log.is_open();
+}
+
+bool timing_session_hw() {
+    return session_hw;
+}
+
+// Одна строка на команду, поля через табуляцию:
+// время начала (мс unix), real, user, sys, maxrss KB, vol/invol ctxsw,
+// cycles, instructions, cache-misses (пусто без -p), команда
+void timing_session_log(const CommandTiming& t, const string& command) {
+    if (!session_log.is_open()) return;
+
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    long long started_ms = (long long)now.tv_sec * 1000 + now.tv_usec / 1000 - (long long)(t.wall * 1000);
+
+    char line[512];
+    snprintf(line, sizeof(line), "%lld\t%.6f\t%.6f\t%.6f\t%ld\t%ld\t%ld\t",
+             started_ms, t.wall, t.user, t.sys, t.maxrss_kb, t.nvcsw, t.nivcsw);
+    session_log << line;
+    if (t.hw_valid) {
+        session_log << t.cycles << '\t' << t.instructions << '\t' << t.cache_misses << '\t';
+    } else {
+        session_log << "\t\t\t";
+    }
+    string flat = command;
+    replace(flat.begin(), flat.end(), '\n', ' ');
+    session_log << flat << '\n';
+    session_log.flush();
+}
+
+// ==================== Встроенная команда ====================
+bool process_time(const string& rest, timing_line_runner run) {
+    string command = rest;
+    command.erase(0, command.find_first_not_of(" \t"));
+
+    if (command.substr(0, 3) == "log" && (command.size() == 3 || command[3] == ' ')) {
+        string arg = command.substr(3);
+        arg.erase(0, arg.find_first_not_of(" \t"));
+
+        if (arg.empty()) {
+            cout << "Usage: time log [-p] FILE | time log off\n";
+        } else if (arg == "off") {
+            if (session_log.is_open()) session_log.close();
+            session_hw = false;
+        } else {
+            bool hw = false;
+            if (arg.substr(0, 3) == "-p ") {
+                hw = true;
+                arg = arg.substr(3);
+                arg.erase(0, arg.find_first_not_of(" \t"));
+            }
+            if (session_log.is_open()) session_log.close();
+            session_log.open(arg, ios::app);
+            if (!session_log) {
+                cerr << "time: cannot open " << arg << ": " << strerror(errno) << "\n";
+            }
+            session_hw = hw && session_log.is_open();
+        }
+        return true;
+    }
+
+    bool hw = false;
+    if (command.substr(0, 3) == "-p " || command == "-p") {
+        hw = true;
+        command = command.substr(2);
+        command.erase(0, command.find_first_not_of(" \t"));
+    }
+
+    CommandTiming t;
+    timing_start(t, hw);
+    bool keep_running = command.empty() ? true : run(command);
+    timing_stop(t);
+    print_report(t);
+    return keep_running;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <sys/resource.h>
+
+// Замер одной команды: время, rusage дочерних процессов (из wait4)
+// и собственного потока шелла, аппаратные счетчики perf для time -p
+struct CommandTiming {
+    bool hw = false;
+    std::chrono::steady_clock::time_point started;
+    struct rusage self_start;
+    int perf_fds[3] = {-1, -1, -1};
+
+    // Результат
+    double wall = 0, user = 0, sys = 0;
+    long maxrss_kb = 0;
+    long nvcsw = 0, nivcsw = 0;
+    bool hw_valid = false;
+    uint64_t cycles = 0, instructions = 0, cache_misses = 0;
+};
+
+void timing_start(CommandTiming& t, bool hw);
+void timing_stop(CommandTiming& t);
+
+// Вызывается после wait4 для каждого завершившегося дочернего процесса
+void timing_child_exited(const struct rusage& usage);
+
+// time [-p] COMMAND, time log [-p] FILE, time log off.
+// run выполняет строку так же, как основной цикл
+typedef bool (*timing_line_runner)(const std::string& line);
+bool process_time(const std::string& rest, timing_line_runner run);
+
+// Журнал всех команд сессии (time log FILE)
+bool timing_session_enabled();
+bool timing_session_hw();
+void timing_session_log(const CommandTiming& t, const std::string& command);
@@ -8,9 +8,20 @@
 #include <cerrno>          
 #include <ctime>           
 #include <string>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>         // open/O_* для временного файла passwd
+#include <shadow.h>        // lckpwdf/ulckpwdf
+#include <grp.h>           // getgrent для индекса групп
+#include <sys/stat.h>
+#include <sys/inotify.h>   // Слежение за /etc/passwd
+#include <syslog.h>        // Ошибки фоновой записи passwd
 #include "vfs.hpp"         //  fuse_start 
 #include <sys/wait.h>      // waitpid
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
 #include <pthread.h>       // Потоки
 
 // ============================================================================
@@ -35,243 +46,914 @@ int run_cmd(const char* cmd, char* const argv[]) {
     return -1;
 }
 
+// Если название шелла >=2 и последние 2 символа в названии == sh 
+static bool valid_shell_path(const std::string& shell) {
+    size_t len = shell.size();
+    return len >= 2 && shell.compare(len - 2, 2, "sh") == 0;
+}
+
 // Для проверки на "правильность" шелла
 // pwd - структура passwd, в которой есть указатели на конкретные данные из файла
 bool valid_shell(struct passwd* pwd) {
     if (!pwd || !pwd->pw_shell) 
         return false;
     
-    size_t len = strlen(pwd->pw_shell);
-    // Если название шелла >=2 и последние 2 символа в названии == sh 
-    return (len >= 2 && strcmp(pwd->pw_shell + len - 2, "sh") == 0);
+    return valid_shell_path(pwd->pw_shell);
 }
 
 // ============================================================================
-// FUSE ОПЕРАЦИИ
+// ОТЛОЖЕННАЯ ЗАПИСЬ В /etc/passwd
 // ============================================================================
 
-// Проверка существования пути, получения прав доступа
-int users_getattr(const char* path, struct stat* st, struct fuse_file_info* fi) {
-    (void) fi;
-    
+// Изменения shell/home не применяются сразу: они копятся в pending_changes,
+// и отдельный поток переписывает /etc/passwd один раз на все изменения,
+// пришедшие за PASSWD_COALESCE_MS. Массовая смена шелла у тысяч
+// пользователей - это одна перезапись файла, а не тысячи usermod
+#define PASSWD_PATH "/etc/passwd"
+#define PASSWD_TMP_PATH "/etc/passwd+"
+#define PASSWD_COALESCE_MS 100
+#define PASSWD_RETRY_MAX_MS 5000   // Предел паузы между повторами неудачной записи
+
+struct PendingUser {
+    std::string home;   // Пустая строка - не менялось
+    std::string shell;
+};
+
+static std::map<std::string, PendingUser> pending_changes;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+
+static void refresh_users();
+
+// Значение атрибута с учетом еще не записанных изменений
+static std::string user_attr_value(const std::string& username, const char* attr, const std::string& stored) {
+    std::string value = stored;
+
+    pthread_mutex_lock(&pending_mutex);
+    auto it = pending_changes.find(username);
+    if (it != pending_changes.end()) {
+        const std::string& pending = std::strcmp(attr, "home") == 0 ? it->second.home : it->second.shell;
+        if (!pending.empty()) value = pending;
+    }
+    pthread_mutex_unlock(&pending_mutex);
+
+    return value;
+}
+
+// Переписываем passwd: строки меняются только у пользователей из changes.
+// Пишем во временный файл рядом и переименовываем - читатели видят либо
+// старый файл, либо новый целиком
+static int rewrite_passwd(const std::map<std::string, PendingUser>& changes) {
+    if (lckpwdf() != 0)
+        return -1;
+
+    int result = -1;
+    FILE* in = std::fopen(PASSWD_PATH, "r");
+    struct stat st;
+    int fd = -1;
+    FILE* out = NULL;
+
+    if (in && fstat(fileno(in), &st) == 0) {
+        fd = open(PASSWD_TMP_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    }
+    if (fd >= 0) {
+        fchown(fd, st.st_uid, st.st_gid);
+        out = fdopen(fd, "w");
+    }
+
+    if (out) {
+        char* line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        bool ok = true;
+
+        while ((len = getline(&line, &cap, in)) > 0) {
+            std::string entry(line, len);
+            size_t colon = entry.find(':');
+            auto it = colon == std::string::npos ? changes.end() : changes.find(entry.substr(0, colon));
+
+            if (it != changes.end()) {
+                // name:passwd:uid:gid:gecos:home:shell
+                std::string fields[7];
+                size_t start = 0;
+                int n = 0;
+                bool newline = !entry.empty() && entry.back() == '\n';
+                if (newline) entry.pop_back();
+                for (; n < 7; n++) {
+                    size_t end = n < 6 ? entry.find(':', start) : std::string::npos;
+                    fields[n] = entry.substr(start, end == std::string::npos ? std::string::npos : end - start);
+                    if (end == std::string::npos) break;
+                    start = end + 1;
+                }
+                if (n == 6) {
+                    if (!it->second.home.empty()) fields[5] = it->second.home;
+                    if (!it->second.shell.empty()) fields[6] = it->second.shell;
+                    entry = fields[0];
+                    for (int i = 1; i < 7; i++) entry += ":" + fields[i];
+                }
+                if (newline) entry += '\n';
+            }
+
+            if (std::fwrite(entry.data(), 1, entry.size(), out) != entry.size()) {
+                ok = false;
+                break;
+            }
+        }
+        std::free(line);
+
+        ok = ok && std::fflush(out) == 0 && fsync(fileno(out)) == 0;
+        ok = (std::fclose(out) == 0) && ok;
+        if (ok && std::rename(PASSWD_TMP_PATH, PASSWD_PATH) == 0) {
+            result = 0;
+        } else {
+            unlink(PASSWD_TMP_PATH);
+        }
+    } else if (fd >= 0) {
+        close(fd);
+        unlink(PASSWD_TMP_PATH);
+    }
+
+    // Ошибку записи сохраняем для сообщения: закрытие и снятие блокировки меняют errno
+    int saved_errno = errno;
+    if (in) std::fclose(in);
+    ulckpwdf();
+    errno = saved_errno;
+    return result;
+}
+
+static void* passwd_writer_thread(void* arg) {
+    (void) arg;
+
+    int retry_ms = 0;   // Пауза перед повтором после неудачи, 0 - ошибок не было
+
+    pthread_mutex_lock(&pending_mutex);
+    while (true) {
+        while (pending_changes.empty()) {
+            pthread_cond_wait(&pending_cond, &pending_mutex);
+        }
+
+        // Ждем окно, собирая все изменения, которые успеют прийти
+        pthread_mutex_unlock(&pending_mutex);
+        usleep(PASSWD_COALESCE_MS * 1000);
+        pthread_mutex_lock(&pending_mutex);
+
+        // Изменения остаются видимыми в pending_changes, пока файл переписывается
+        std::map<std::string, PendingUser> batch = pending_changes;
+        pthread_mutex_unlock(&pending_mutex);
+
+        bool drop = false;
+        if (rewrite_passwd(batch) != 0) {
+            // close() уже вернул успех, а чтение показывает новое значение,
+            // поэтому временные ошибки (passwd занят, нет места) не теряют
+            // изменения: они остаются в очереди и записываются повторно
+            // с растущей паузой. Нет прав или файловая система только для
+            // чтения - повтор не поможет, такие изменения выбрасываем
+            int err = errno;
+            if (err == EACCES || err == EPERM || err == EROFS) {
+                syslog(LOG_ERR, "kubsh: cannot update %s: %s, %zu change(s) dropped",
+                       PASSWD_PATH, std::strerror(err), batch.size());
+                retry_ms = 0;
+                drop = true;
+            } else if (retry_ms == 0) {
+                syslog(LOG_ERR, "kubsh: cannot update %s: %s, %zu change(s) pending, retrying",
+                       PASSWD_PATH, std::strerror(err), batch.size());
+                retry_ms = PASSWD_COALESCE_MS;
+            } else if (retry_ms < PASSWD_RETRY_MAX_MS) {
+                retry_ms = std::min(retry_ms * 2, PASSWD_RETRY_MAX_MS);
+            }
+            if (!drop) {
+                usleep(retry_ms * 1000);
+                pthread_mutex_lock(&pending_mutex);
+                continue;
+            }
+        } else if (retry_ms != 0) {
+            syslog(LOG_NOTICE, "kubsh: %s updated after retrying", PASSWD_PATH);
+            retry_ms = 0;
+        }
+
+        // Сначала обновляем кэш пользователей, и только потом убираем
+        // примененное из очереди: иначе до события inotify чтение снова
+        // показало бы старое значение. То, что изменилось за время записи,
+        // ждет следующего окна
+        refresh_users();
+        pthread_mutex_lock(&pending_mutex);
+        for (const auto& change : batch) {
+            auto it = pending_changes.find(change.first);
+            if (it != pending_changes.end() &&
+                it->second.home == change.second.home &&
+                it->second.shell == change.second.shell) {
+                pending_changes.erase(it);
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void start_passwd_writer() {
+    pthread_t writer;
+    if (pthread_create(&writer, nullptr, passwd_writer_thread, nullptr) == 0)
+        pthread_detach(writer);
+}
+
+static void queue_user_change(const char* username, const char* attr, const std::string& value) {
+    pthread_once(&writer_once, start_passwd_writer);
+
+    pthread_mutex_lock(&pending_mutex);
+    PendingUser& change = pending_changes[username];
+    if (std::strcmp(attr, "home") == 0)
+        change.home = value;
+    else
+        change.shell = value;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+// Проверка нового значения: абсолютный путь без ':' и переводов строк,
+// шелл к тому же должен быть исполняемым файлом
+static bool valid_attr_value(const char* attr, const std::string& value) {
+    if (value.empty() || value[0] != '/')
+        return false;
+    if (value.find_first_of(":\n", 0) != std::string::npos || value.find('\0') != std::string::npos)
+        return false;
+
+    if (std::strcmp(attr, "shell") == 0) {
+        struct stat st;
+        return stat(value.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(value.c_str(), X_OK) == 0;
+    }
+    return true;
+}
+
+// Файлы, которые лежат в директории каждого пользователя
+const char* const vfs_user_files[] = { "id", "home", "shell", "gid", "groups", nullptr };
+
+// ============================================================================
+// НОМЕРА ИНОДОВ
+// ============================================================================
+
+// Номер инода сам описывает объект: старшие биты - uid + 1, младшие 3 бита -
+// вид объекта (директория пользователя или индекс файла в vfs_user_files + 1).
+// lookup/getattr/read получают все нужное из числа, без разбора строк пути.
+// Корень - FUSE_ROOT_ID (1), он меньше любого инода пользователя (>= 8)
+#define INO_KIND_BITS 3
+#define INO_KIND_MASK ((1 << INO_KIND_BITS) - 1)
+#define KIND_DIR 0
+
+static inline fuse_ino_t make_ino(uid_t uid, int kind) {
+    return (((fuse_ino_t)uid + 1) << INO_KIND_BITS) | kind;
+}
+
+static inline uid_t ino_uid(fuse_ino_t ino) {
+    return (uid_t)((ino >> INO_KIND_BITS) - 1);
+}
+
+static inline int ino_kind(fuse_ino_t ino) {
+    return ino & INO_KIND_MASK;
+}
+
+// Индекс файла по имени: 1.. для файлов из vfs_user_files, -1 если такого нет
+static int attr_kind(const char* name) {
+    for (int i = 0; vfs_user_files[i]; i++) {
+        if (std::strcmp(vfs_user_files[i], name) == 0)
+            return i + 1;
+    }
+    return -1;
+}
+
+static const char* kind_name(int kind) {
+    return vfs_user_files[kind - 1];
+}
+
+// Менять через файловую систему можно только home и shell
+static bool kind_writable(int kind) {
+    const char* name = kind_name(kind);
+    return std::strcmp(name, "home") == 0 || std::strcmp(name, "shell") == 0;
+}
+
+// Время жизни записей в кэше ядра. Изменения passwd доходят до ядра
+// через точечную инвалидацию, поэтому можно не опрашивать нас часто
+#define ENTRY_TIMEOUT 1.0
+
+// ============================================================================
+// КЭШ ПОЛЬЗОВАТЕЛЕЙ
+// ============================================================================
+
+// Копия базы пользователей: поиск по uid и по имени за O(1) вместо
+// getpwnam/getpwuid, которые каждый раз читают /etc/passwd с начала
+struct UserEntry {
+    std::string name;
+    uid_t uid;
+    gid_t gid;
+    std::string home;
+    std::string shell;
+};
+
+struct UsersCache {
+    std::unordered_map<uid_t, UserEntry> by_uid;
+    std::unordered_map<std::string, uid_t> by_name;
+    std::vector<std::string> listed;   // Пользователи с "правильным" шеллом, в порядке passwd
+};
+
+static UsersCache users_cache;
+static pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct fuse_session* users_session = NULL;
+
+// Что нужно сбросить в кэше ядра после перечитывания passwd
+struct Invalidation {
+    std::vector<std::string> entries;   // Имена в корне
+    std::vector<fuse_ino_t> inodes;
+};
+
+static void load_users(UsersCache& cache) {
+    struct passwd* pwd;
+    setpwent();
+
+    while ((pwd = getpwent()) != NULL) {
+        if (cache.by_name.count(pwd->pw_name))
+            continue;
+
+        cache.by_name[pwd->pw_name] = pwd->pw_uid;
+        if (!cache.by_uid.count(pwd->pw_uid)) {
+            cache.by_uid[pwd->pw_uid] = UserEntry{pwd->pw_name, pwd->pw_uid, pwd->pw_gid, pwd->pw_dir, pwd->pw_shell};
+        }
+        if (valid_shell(pwd))
+            cache.listed.push_back(pwd->pw_name);
+    }
+
+    endpwent();
+}
+
+// Перечитываем пользователей и сравниваем со старой копией,
+// чтобы сбросить в ядре только то, что действительно изменилось
+static Invalidation reload_users() {
+    UsersCache fresh;
+    load_users(fresh);
+
+    Invalidation inval;
+    pthread_mutex_lock(&users_mutex);
+    UsersCache& old = users_cache;
+
+    for (const auto& item : old.by_name) {
+        auto it = fresh.by_name.find(item.first);
+        if (it == fresh.by_name.end() || it->second != item.second)
+            inval.entries.push_back(item.first);
+    }
+    for (const auto& item : fresh.by_name) {
+        if (!old.by_name.count(item.first))
+            inval.entries.push_back(item.first);
+    }
+    for (const auto& item : fresh.by_uid) {
+        auto it = old.by_uid.find(item.first);
+        if (it == old.by_uid.end())
+            continue;
+        const UserEntry& was = it->second;
+        const UserEntry& now = item.second;
+        if (was.gid != now.gid || was.home != now.home || was.shell != now.shell) {
+            inval.inodes.push_back(make_ino(now.uid, KIND_DIR));
+            for (int kind = 1; vfs_user_files[kind - 1]; kind++)
+                inval.inodes.push_back(make_ino(now.uid, kind));
+        }
+    }
+
+    users_cache = std::move(fresh);
+    pthread_mutex_unlock(&users_mutex);
+    return inval;
+}
+
+// Сбрасываем записи в кэше ядра. Только из своих потоков, не из обработчиков
+static void send_invalidations(const Invalidation& inval) {
+    if (!users_session)
+        return;
+    for (const auto& name : inval.entries)
+        fuse_lowlevel_notify_inval_entry(users_session, FUSE_ROOT_ID, name.c_str(), name.size());
+    for (fuse_ino_t ino : inval.inodes)
+        fuse_lowlevel_notify_inval_inode(users_session, ino, 0, 0);
+}
+
+// Перечитываем passwd после собственной записи, не дожидаясь inotify
+static void refresh_users() {
+    send_invalidations(reload_users());
+}
+
+// Копия записи пользователя по uid
+static bool find_user(uid_t uid, UserEntry& out) {
+    pthread_mutex_lock(&users_mutex);
+    auto it = users_cache.by_uid.find(uid);
+    bool found = it != users_cache.by_uid.end();
+    if (found)
+        out = it->second;
+    pthread_mutex_unlock(&users_mutex);
+    return found;
+}
+
+static bool find_user_by_name(const char* name, UserEntry& out) {
+    pthread_mutex_lock(&users_mutex);
+    auto it = users_cache.by_name.find(name);
+    bool found = it != users_cache.by_name.end();
+    if (found)
+        out = users_cache.by_uid[it->second];
+    pthread_mutex_unlock(&users_mutex);
+    return found;
+}
+
+// ============================================================================
+// ИНДЕКС ГРУПП
+// ============================================================================
+
+// Обратный индекс пользователь -> группы, собранный за один проход по базе
+// групп. getgrouplist на каждый запрос просматривает все группы, а так
+// чтение groups стоит столько, сколько групп у пользователя.
+// Перестраивается целиком, когда меняется /etc/group
+struct GroupIndex {
+    std::unordered_map<gid_t, std::string> names;                       // gid -> имя группы
+    std::unordered_map<std::string, std::vector<gid_t>> member_of;     // Дополнительные группы пользователя
+};
+
+static GroupIndex group_index;
+static pthread_mutex_t groups_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void load_groups(GroupIndex& index) {
+    struct group* grp;
+    setgrent();
+
+    while ((grp = getgrent()) != NULL) {
+        if (!index.names.count(grp->gr_gid))
+            index.names[grp->gr_gid] = grp->gr_name;
+
+        for (char** member = grp->gr_mem; member && *member; member++)
+            index.member_of[*member].push_back(grp->gr_gid);
+    }
+
+    endgrent();
+}
+
+// Перестраиваем индекс и возвращаем имена пользователей,
+// у которых изменился список групп
+static std::vector<std::string> reload_groups() {
+    GroupIndex fresh;
+    load_groups(fresh);
+
+    std::vector<std::string> changed;
+    pthread_mutex_lock(&groups_mutex);
+    GroupIndex& old = group_index;
+
+    // Переименование группы меняет файл groups у всех ее участников,
+    // проще считать изменившимися всех, если поменялись имена
+    bool renamed = old.names != fresh.names;
+    for (const auto& item : fresh.member_of) {
+        auto it = old.member_of.find(item.first);
+        if (renamed || it == old.member_of.end() || it->second != item.second)
+            changed.push_back(item.first);
+    }
+    for (const auto& item : old.member_of) {
+        if (!fresh.member_of.count(item.first))
+            changed.push_back(item.first);
+    }
+    if (renamed) {
+        // Основная группа пользователя тоже входит в groups
+        pthread_mutex_lock(&users_mutex);
+        for (const auto& name : users_cache.listed)
+            changed.push_back(name);
+        pthread_mutex_unlock(&users_mutex);
+    }
+
+    group_index = std::move(fresh);
+    pthread_mutex_unlock(&groups_mutex);
+    return changed;
+}
+
+static void append_group_name(std::string& out, gid_t gid) {
+    if (!out.empty())
+        out += ' ';
+
+    auto it = group_index.names.find(gid);
+    if (it != group_index.names.end())
+        out += it->second;
+    else
+        out += std::to_string(gid);   // Группы нет в базе - как у id(1)
+}
+
+// Содержимое groups: основная группа, затем дополнительные, через пробел
+static std::string user_groups(const UserEntry& user) {
+    std::string out;
+
+    pthread_mutex_lock(&groups_mutex);
+    append_group_name(out, user.gid);
+    auto it = group_index.member_of.find(user.name);
+    if (it != group_index.member_of.end()) {
+        for (gid_t gid : it->second) {
+            if (gid != user.gid)
+                append_group_name(out, gid);
+        }
+    }
+    pthread_mutex_unlock(&groups_mutex);
+
+    return out;
+}
+
+// Содержимое файла-атрибута
+static std::string attr_content(const UserEntry& user, int kind) {
+    const char* name = kind_name(kind);
+    if (std::strcmp(name, "id") == 0)
+        return std::to_string(user.uid);
+    if (std::strcmp(name, "gid") == 0)
+        return std::to_string(user.gid);
+    if (std::strcmp(name, "groups") == 0)
+        return user_groups(user);
+    if (std::strcmp(name, "home") == 0)
+        return user_attr_value(user.name, name, user.home);
+    return user_attr_value(user.name, name, user.shell);
+}
+
+// Заполнение stat по иноду
+static bool fill_stat(fuse_ino_t ino, struct stat* st) {
     // Обнуление полей st
-    memset(st, 0, sizeof(struct stat));
-    
+    std::memset(st, 0, sizeof(struct stat));
+    st->st_ino = ino;
+
     // Ставим время изменения, доступа и модификации на текущее
     time_t now = time(NULL);
     st->st_atime = st->st_mtime = st->st_ctime = now;
 
-    // Если корневая директория - владелец текущий пользователь
-    if (strcmp(path, "/") == 0) {
+    // Корневая директория - владелец текущий пользователь
+    if (ino == FUSE_ROOT_ID) {
         st->st_mode = S_IFDIR | 0755;  // Права rwxr-xr-x
+        st->st_nlink = 2;
         st->st_uid = getuid();
         st->st_gid = getgid();
-        return 0;
+        return true;
     }
 
-    char username[256];
-    char filename[256];
+    UserEntry user;
+    int kind = ino_kind(ino);
+    if (kind > (int)(sizeof(vfs_user_files) / sizeof(vfs_user_files[0]) - 1) || !find_user(ino_uid(ino), user))
+        return false;
 
-    // Файлы в директориях пользователей
-    // Разбиваем path на /...(255)/...
-    // Если удачно то кладем первую часть в username, вторую в filename 
-    if (sscanf(path, "/%255[^/]/%255[^/]", username, filename) == 2) {
-        // getpwnam ищем в pwd пользователя username
-        struct passwd* pwd = getpwnam(username);
+    st->st_uid = user.uid;  // Владелец - пользователь
+    st->st_gid = user.gid;
+    if (kind == KIND_DIR) {
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+    } else {
+        // Обычный файл с правами rw-r--r--, id, gid и groups менять нельзя - r--r--r--
+        st->st_mode = S_IFREG | (kind_writable(kind) ? 0644 : 0444);
+        st->st_nlink = 1;
+        // Настоящий размер: чтение через страничный кэш ядро обрезает по
+        // st_size, а groups и home бывают длиннее любого фиксированного значения
+        st->st_size = attr_content(user, kind).size();
+    }
+    return true;
+}
 
-        // Если файл это id/home/shell, иначе файл не найден
-        if (strcmp(filename, "id") != 0 &&
-            strcmp(filename, "home") != 0 &&
-            strcmp(filename, "shell") != 0) {
-            return -ENOENT;
-        }
+static void reply_entry(fuse_req_t req, fuse_ino_t ino) {
+    struct fuse_entry_param e;
+    std::memset(&e, 0, sizeof(e));
+    if (!fill_stat(ino, &e.attr)) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    e.ino = ino;
+    e.attr_timeout = ENTRY_TIMEOUT;
+    e.entry_timeout = ENTRY_TIMEOUT;
+    fuse_reply_entry(req, &e);
+}
 
-        // Если нашли в pwd(то есть не NULL)
-        if (pwd != NULL) {
-            st->st_mode = S_IFREG | 0644;  // Обычный файл с правами rw-r--r--
-            st->st_uid = pwd->pw_uid;      // Владелец - пользователь
-            st->st_gid = pwd->pw_gid;
-            st->st_size = 256;             // Размер файла 256 байт
-            return 0;
-        }
-        return -ENOENT;
-    }
-
-    // Директории пользователей
-    // Если разбили path только на /...
-    if (sscanf(path, "/%255[^/]", username) == 1) {
-        struct passwd* pwd = getpwnam(username);
-        if (pwd != NULL) {
-            st->st_mode = S_IFDIR | 0755;
-            st->st_uid = pwd->pw_uid;  // Владелец - пользователь
-            st->st_gid = pwd->pw_gid;
-            return 0;
+// ============================================================================
+// FUSE ОПЕРАЦИИ
+// ============================================================================
+
+// Поиск имени в директории: в корне - пользователь, в директории пользователя - файл
+void users_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    if (parent == FUSE_ROOT_ID) {
+        UserEntry user;
+        if (!find_user_by_name(name, user)) {
+            fuse_reply_err(req, ENOENT);
+            return;
         }
-        return -ENOENT;
+        reply_entry(req, make_ino(user.uid, KIND_DIR));
+        return;
     }
 
-    return -ENOENT;
+    int kind = attr_kind(name);
+    if (ino_kind(parent) != KIND_DIR || kind < 0) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    reply_entry(req, make_ino(ino_uid(parent), kind));
 }
 
-int users_readdir(
-    const char* path,
-    void* buf, 
-    fuse_fill_dir_t filler, 
-    off_t offset, 
-    struct fuse_file_info* fi, 
-    enum fuse_readdir_flags flags
-) {
-    (void) offset;
+// Проверка существования, получение прав доступа
+void users_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
     (void) fi;
-    (void) flags;
-
-    // filler - функция, которая добавляет одну запись в виртуальную директорию
-    filler(buf, ".", NULL, 0, FUSE_FILL_DIR_PLUS);
-    filler(buf, "..", NULL, 0, FUSE_FILL_DIR_PLUS);
-
-    // Если в корне, то смотрим все user'ов в passwd, и пока находим новых проверяем их на шелл
-    // и заполняем buf в который ложим записи 
-    if (std::strcmp(path, "/") == 0) {
-        struct passwd* pwd;
-        setpwent();
-
-        while ((pwd = getpwent()) != NULL) {
-            if (valid_shell(pwd)) {
-                // buf - буфер куда ложим записи, pwd->pw_name - имя файла или директории
-                filler(buf, pwd->pw_name, NULL, 0, FUSE_FILL_DIR_PLUS);
-            }
-        }
 
-        endpwent();
-        return 0;
+    struct stat st;
+    if (!fill_stat(ino, &st)) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
+    fuse_reply_attr(req, &st, ENTRY_TIMEOUT);
+}
+
+// Список записей директории снимается один раз в opendir и хранится в fi->fh,
+// чтобы чтение длинного корня кусками не пересобирало его каждый раз
+struct DirListing {
+    std::vector<std::string> names;
+    std::vector<fuse_ino_t> inodes;
+};
 
-    char username[256] = {0};
-    if (sscanf(path, "/%255[^/]", username) == 1) {
-        struct passwd* pwd = getpwnam(username);
-        if (pwd != NULL) {
-            // Складываем все файлы в каждом user в буфер
-            filler(buf, "id", NULL, 0, FUSE_FILL_DIR_PLUS);
-            filler(buf, "home", NULL, 0, FUSE_FILL_DIR_PLUS);
-            filler(buf, "shell", NULL, 0, FUSE_FILL_DIR_PLUS);
-            return 0;
+void users_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    DirListing* list = new DirListing;
+    list->names.push_back(".");
+    list->inodes.push_back(ino);
+    list->names.push_back("..");
+    list->inodes.push_back(FUSE_ROOT_ID);
+
+    if (ino == FUSE_ROOT_ID) {
+        // В корне - все пользователи с "правильным" шеллом
+        pthread_mutex_lock(&users_mutex);
+        for (const auto& name : users_cache.listed) {
+            list->names.push_back(name);
+            list->inodes.push_back(make_ino(users_cache.by_name[name], KIND_DIR));
+        }
+        pthread_mutex_unlock(&users_mutex);
+    } else {
+        UserEntry user;
+        if (ino_kind(ino) != KIND_DIR || !find_user(ino_uid(ino), user)) {
+            delete list;
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        // Складываем все файлы пользователя
+        for (int i = 0; vfs_user_files[i]; i++) {
+            list->names.push_back(vfs_user_files[i]);
+            list->inodes.push_back(make_ino(user.uid, i + 1));
         }
     }
-    
-    // После отработки функции все что было в buf отправится в файловую систему
-    return -ENOENT;
+
+    fi->fh = (uint64_t)list;
+    fuse_reply_open(req, fi);
 }
 
-int users_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
-    (void) fi;
+void users_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) ino;
 
-    char username[256];
-    char filename[256];
+    DirListing* list = (DirListing*)fi->fh;
+    std::vector<char> buf(size);
+    size_t used = 0;
 
-    // Разбиваем path на 2 части: имя и файл (id/dir/shell)
-    std::sscanf(path, "/%255[^/]/%255[^/]", username, filename);
+    // offset - номер записи, с которой продолжаем
+    for (size_t i = offset; i < list->names.size(); i++) {
+        struct stat st;
+        std::memset(&st, 0, sizeof(st));
+        st.st_ino = list->inodes[i];
+        st.st_mode = ino_kind(list->inodes[i]) == KIND_DIR || list->inodes[i] == FUSE_ROOT_ID ? S_IFDIR : S_IFREG;
 
-    // Ищем в pwd информацию о username
-    struct passwd* pwd = getpwnam(username);
-    if(!pwd) return -ENOENT;
-    
-    char content[256];
-    content[0] = '\0';
+        size_t len = fuse_add_direntry(req, buf.data() + used, size - used, list->names[i].c_str(), &st, i + 1);
+        if (len > size - used)
+            break;
+        used += len;
+    }
+
+    fuse_reply_buf(req, buf.data(), used);
+}
+
+void users_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void) ino;
+
+    delete (DirListing*)fi->fh;
+    fuse_reply_err(req, 0);
+}
 
-    if (std::strcmp(filename, "id") == 0) {
-        // content - куда записываем, 256 байт максимум, %d - целое число, берем из pw_uid
-        std::snprintf(content, sizeof(content), "%d", pwd->pw_uid);
+// Буфер открытого на запись файла, хранится в fi->fh
+struct WriteBuffer {
+    std::string username;
+    int kind;
+    std::string data;
+    bool dirty;
+};
+
+#define ATTR_MAX_SIZE 4096
+
+void users_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    UserEntry user;
+    int kind = ino_kind(ino);
+    if (ino == FUSE_ROOT_ID || kind == KIND_DIR) {
+        fuse_reply_err(req, EISDIR);
+        return;
     }
-    else if (std::strcmp(filename, "home") == 0) {
-        // %s - строка
-        std::snprintf(content, sizeof(content), "%s", pwd->pw_dir);
+    if (!find_user(ino_uid(ino), user)) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
-    else {
-        std::snprintf(content, sizeof(content), "%s", pwd->pw_shell);
+
+    fi->fh = 0;
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        // id, gid и groups только для чтения
+        if (!kind_writable(kind)) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+
+        WriteBuffer* wb = new WriteBuffer{user.name, kind, "", false};
+        if (!(fi->flags & O_TRUNC))
+            wb->data = attr_content(user, kind);
+        else
+            wb->dirty = true;
+
+        fi->fh = (uint64_t)wb;
     }
 
-    size_t len = std::strlen(content);
-    if (len > 0 && content[len-1] == '\n') {
-        content[len-1] = '\0';
-        len--;
+    // Без страничного кэша: значение меняется из очереди записи раньше, чем
+    // ядро узнает новый размер, и чтение не должно обрезаться по старому st_size
+    fi->direct_io = 1;
+    fuse_reply_open(req, fi);
+}
+
+void users_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+
+    UserEntry user;
+    int kind = ino_kind(ino);
+    if (ino == FUSE_ROOT_ID || kind == KIND_DIR || !find_user(ino_uid(ino), user)) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
 
+    std::string content = attr_content(user, kind);
+
     // Проверка чтобы не читали за пределом файла
-    if ((size_t)offset >= len) {
-        return 0;
+    if ((size_t)offset >= content.size()) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
     }
 
     // Указываем сколько байт можно прочитать
-    if (offset + size > len) {
-        size = len - offset;
+    if (offset + size > content.size())
+        size = content.size() - offset;
+
+    fuse_reply_buf(req, content.data() + offset, size);
+}
+
+void users_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t offset,
+                 struct fuse_file_info* fi) {
+    (void) ino;
+
+    WriteBuffer* wb = (WriteBuffer*)fi->fh;
+    if (!wb) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+    if (offset + size > ATTR_MAX_SIZE) {
+        fuse_reply_err(req, EFBIG);
+        return;
     }
 
-    // Копируем данные в буфер 
-    std::memcpy(buf, content + offset, size);
-    
-    // Возврат сколько байт прочитали
-    return size;
+    if (wb->data.size() < offset + size)
+        wb->data.resize(offset + size);
+    std::memcpy(&wb->data[offset], buf, size);
+    wb->dirty = true;
+    fuse_reply_write(req, size);
 }
 
-int users_mkdir(const char* path, mode_t mode) {
+// Из изменений атрибутов поддерживаем только размер (truncate)
+void users_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi) {
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        int kind = ino_kind(ino);
+        if (ino == FUSE_ROOT_ID || kind == KIND_DIR) {
+            fuse_reply_err(req, EISDIR);
+            return;
+        }
+        if (!kind_writable(kind)) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+
+        if (fi && fi->fh) {
+            WriteBuffer* wb = (WriteBuffer*)fi->fh;
+            if (attr->st_size > ATTR_MAX_SIZE) {
+                fuse_reply_err(req, EFBIG);
+                return;
+            }
+            wb->data.resize(attr->st_size);
+            wb->dirty = true;
+        } else if (attr->st_size != 0) {
+            // truncate без открытого файла: новое значение придет следующей записью
+            fuse_reply_err(req, EINVAL);
+            return;
+        }
+    }
+
+    users_getattr(req, ino, fi);
+}
+
+// Проверка и постановка изменения в очередь при close()
+static int flush_buffer(WriteBuffer* wb) {
+    if (!wb || !wb->dirty)
+        return 0;
+
+    // echo добавляет перевод строки - отрезаем его и пробелы по краям
+    std::string value = wb->data;
+    size_t end = value.find_last_not_of(" \t\r\n");
+    value.resize(end == std::string::npos ? 0 : end + 1);
+
+    const char* attr = kind_name(wb->kind);
+    if (!valid_attr_value(attr, value))
+        return EINVAL;
+    // Переписать passwd может только root - не обещаем изменение,
+    // которое поток записи все равно не сможет применить
+    if (geteuid() != 0)
+        return EACCES;
+
+    queue_user_change(wb->username.c_str(), attr, value);
+    wb->dirty = false;
+    return 0;
+}
+
+void users_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void) ino;
+    fuse_reply_err(req, flush_buffer((WriteBuffer*)fi->fh));
+}
+
+void users_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void) ino;
+
+    WriteBuffer* wb = (WriteBuffer*)fi->fh;
+    if (wb) {
+        flush_buffer(wb);
+        delete wb;
+        fi->fh = 0;
+    }
+    fuse_reply_err(req, 0);
+}
+
+void users_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
     (void) mode;
 
-    char username[256];
+    // Пользователи создаются только в корне
+    if (parent != FUSE_ROOT_ID) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
 
-    // Если извлекли только имя пользователя из path
-    if (std::sscanf(path, "/%255[^/]", username) == 1) {
-        // Открываем pwd и ищем username
-        struct passwd* pwd = getpwnam(username);
-        
-        // Возврат если такой пользователь уже существует 
-        if (pwd != NULL) {
-            return -EEXIST;
-        }
+    // Возврат если такой пользователь уже существует 
+    UserEntry user;
+    if (find_user_by_name(name, user)) {
+        fuse_reply_err(req, EEXIST);
+        return;
+    }
 
-        // Строки которые передадим для выполнения через run_cmd (fork)  
-        char* const argv[] = {
-            (char*)"adduser", 
-            (char*)"--disabled-password",
-            (char*)"--gecos", 
-            (char*)"", 
-            (char*)username, 
-            NULL
-        };
+    // Строки которые передадим для выполнения через run_cmd (fork)  
+    char* const argv[] = {
+        (char*)"adduser", 
+        (char*)"--disabled-password",
+        (char*)"--gecos", 
+        (char*)"", 
+        (char*)name, 
+        NULL
+    };
 
-        if (run_cmd("adduser", argv) != 0) 
-            return -EIO;
+    if (run_cmd("adduser", argv) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
-    return 0;
+    // Новую запись ядро добавит само, сбрасывать ничего не нужно
+    reload_users();
+    if (!find_user_by_name(name, user)) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    reply_entry(req, make_ino(user.uid, KIND_DIR));
 }
 
-int users_rmdir(const char* path) {
-    char username[256];
-    
-    // Если извлекли только имя пользователя из path
-    if (std::sscanf(path, "/%255[^/]", username) == 1) {
-        // Проверка есть ли вложенные файлы в path
-        // Если не находим "/" в path не считая первый (/.../ <-- типо такого)
-        if (std::strchr(path + 1, '/') == NULL) {
-            struct passwd* pwd = getpwnam(username);
-            if (pwd != NULL) {
-                char* const argv[] = {
-                    (char*)"userdel", 
-                    (char*)"--remove", 
-                    (char*)username, 
-                    NULL
-                };
-
-                if (run_cmd("userdel", argv) != 0) 
-                    return -EIO;
-
-                return -EIO;
-            }
-            return -ENOENT;
-        }
-        return -EPERM;
+void users_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    // Удалять можно только директории пользователей в корне
+    if (parent != FUSE_ROOT_ID) {
+        fuse_reply_err(req, EPERM);
+        return;
     }
-    return -EPERM;
+
+    UserEntry user;
+    if (!find_user_by_name(name, user)) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    char* const argv[] = {
+        (char*)"userdel", 
+        (char*)"--remove", 
+        (char*)name, 
+        NULL
+    };
+
+    if (run_cmd("userdel", argv) != 0) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+
+    reload_users();
+    fuse_reply_err(req, 0);
 }
 
 // ============================================================================
@@ -279,15 +961,83 @@ int users_rmdir(const char* path) {
 // ============================================================================
 
 // Структура в которой описаны функции которые переопределим для vfs
-// Инициализирую все нулями, потом с помощью функции переопределю нужные 5
-struct fuse_operations users_operations = {};
+// Инициализирую все нулями, потом с помощью функции переопределю нужные
+struct fuse_lowlevel_ops users_operations = {};
 
 void init_users_operations() {
-    users_operations.getattr = users_getattr;
-    users_operations.readdir = users_readdir;
-    users_operations.mkdir   = users_mkdir;
-    users_operations.rmdir   = users_rmdir;
-    users_operations.read    = users_read;
+    users_operations.lookup     = users_lookup;
+    users_operations.getattr    = users_getattr;
+    users_operations.setattr    = users_setattr;
+    users_operations.opendir    = users_opendir;
+    users_operations.readdir    = users_readdir;
+    users_operations.releasedir = users_releasedir;
+    users_operations.mkdir      = users_mkdir;
+    users_operations.rmdir      = users_rmdir;
+    users_operations.open       = users_open;
+    users_operations.read       = users_read;
+    users_operations.write      = users_write;
+    users_operations.flush      = users_flush;
+    users_operations.release    = users_release;
+}
+
+// ============================================================================
+// СЛЕЖЕНИЕ ЗА /etc/passwd И /etc/group
+// ============================================================================
+
+// Сбрасывать записи ядра из обработчиков запросов нельзя (можно получить
+// взаимоблокировку), поэтому это делает отдельный поток: он ждет изменений
+// passwd и group в /etc (файлы заменяются через rename, так что следим за
+// каталогом), перечитывает их и сбрасывает только изменившиеся записи
+static void* passwd_watch_thread(void* arg) {
+    (void) arg;
+
+    int ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd < 0)
+        return nullptr;
+    if (inotify_add_watch(ifd, "/etc", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        close(ifd);
+        return nullptr;
+    }
+
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        ssize_t len = read(ifd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+
+        bool passwd_changed = false;
+        bool group_changed = false;
+        for (char* p = buf; p < buf + len; ) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->len == 0)
+                continue;
+            if (std::strcmp(ev->name, "passwd") == 0)
+                passwd_changed = true;
+            else if (std::strcmp(ev->name, "group") == 0)
+                group_changed = true;
+        }
+
+        Invalidation inval;
+        if (passwd_changed)
+            inval = reload_users();
+        if (group_changed) {
+            // Сбрасываем только файлы groups тех, чей список групп поменялся
+            int kind = attr_kind("groups");
+            for (const auto& name : reload_groups()) {
+                UserEntry user;
+                if (find_user_by_name(name.c_str(), user))
+                    inval.inodes.push_back(make_ino(user.uid, kind));
+            }
+        }
+        send_invalidations(inval);
+    }
+
+    close(ifd);
+    return nullptr;
 }
 
 // ============================================================================
@@ -299,34 +1049,51 @@ void* fuse_thread_function(void* arg) {
 
     // Вызов функции для инициализации
     init_users_operations();
+    reload_users();
+    reload_groups();
 
-    // Отключение лишних логов
-    int devnull = open("/dev/null", O_WRONLY);
-    int olderr = dup(STDERR_FILENO);
-    dup2(devnull, STDERR_FILENO);
-    close(devnull);
-
-    // Аргументы для fuse_main
+    // Аргументы для сессии FUSE
     char* fuse_argv[] = {
         (char*) "kubsh",                    // Имя программы
-        (char*) "-f",
         (char*) "-odefault_permissions",    // Стандартные права доступа
         (char*) "-oauto_unmount",           // Автоматическое размонтирование
-        (char*) "/opt/users"                // Куда монтируем
     };
 
     // Количество аргументов
     int fuse_argc = sizeof(fuse_argv) / sizeof(fuse_argv[0]);
+    struct fuse_args args = FUSE_ARGS_INIT(fuse_argc, (char**)fuse_argv);
+
+    // Отключение лишних логов только на время создания сессии и монтирования:
+    // дескриптор 2 общий на весь процесс, и шелл пишет в него отчеты time и parallel
+    int devnull = open("/dev/null", O_WRONLY);
+    int olderr = dup(STDERR_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    close(devnull);
 
-    // Первые два аргумента - передаем запуск будто из командой строки
-    // users_operations - структура с функциями
-    // Последний аргумент нам не нужен
-    fuse_main(fuse_argc, (char**)fuse_argv, &users_operations, nullptr);
+    // Низкоуровневая сессия: ядро обращается к нам по номерам инодов
+    struct fuse_session* se = fuse_session_new(&args, &users_operations, sizeof(users_operations), nullptr);
+    bool mounted = se != nullptr && fuse_session_mount(se, "/opt/users") == 0;
 
     // Возврат логов
     dup2(olderr, STDERR_FILENO);
     close(olderr);
 
+    if (mounted) {
+        users_session = se;
+
+        pthread_t watcher;
+        if (pthread_create(&watcher, nullptr, passwd_watch_thread, nullptr) == 0)
+            pthread_detach(watcher);
+
+        fuse_session_loop(se);
+
+        users_session = nullptr;
+        fuse_session_unmount(se);
+    }
+    if (se != nullptr)
+        fuse_session_destroy(se);
+    fuse_opt_free_args(&args);
+
     return nullptr;
 }
 
@@ -338,7 +1105,7 @@ void fuse_start() {
     // Создаем поток fuse_thread
     pthread_t fuse_thread;
 
-    // Запускаем в этом потоке функцию в которой fuse_main
+    // Запускаем в этом потоке функцию в которой цикл сессии fuse
     // Это нужно чтобы vfs не блокировала работу шелла
     pthread_create(&fuse_thread, nullptr, fuse_thread_function, nullptr);
 }
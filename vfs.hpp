@@ -2,4 +2,11 @@
 
 void fuse_start();
 
+struct passwd;
+
+// Пользователи с "правильным" шеллом, которые видны в /opt/users
+bool valid_shell(struct passwd* pwd);
+
+// Файлы внутри /opt/users/<name>, список заканчивается nullptr
+extern const char* const vfs_user_files[];
 